@@ -1,5 +1,8 @@
+#pragma once
+
 #include <iostream>
 #include <string>
+#include <string_view>
 #include <deque>
 #include <vector>
 #include <thread>
@@ -10,9 +13,30 @@
 #include <syncstream>
 #include <memory>
 #include <unordered_map>
+#include <array>
+#include <algorithm>
+#include <functional>
+#include <random>
+#include <future>
+#include <tuple>
+#include <utility>
+#include <type_traits>
+#include <cstring>
+#include <cstdio>
+
+#include "MpmcQueue.cpp"
+#include "WorkStealingDeque.cpp"
+#include "Task.cpp"
+#include "TimerService.cpp"
+#include "Async.cpp"
+#include "TokenBucket.cpp"
+#include "BlockPool.cpp"
+#include "WriteAheadLog.cpp"
+#include "DuplicateFilter.cpp"
+#include "LatencyMetrics.cpp"
 
 // Enum for different social media platforms
-enum class Platform {
+enum class Platform : uint8_t {
     FACEBOOK,
     TWITTER,
     INSTAGRAM,
@@ -21,122 +45,1192 @@ enum class Platform {
     STACKOVERFLOW
 };
 
+constexpr size_t PLATFORM_COUNT = 6;
+
+inline size_t platformIndex(Platform platform)
+{
+    return (size_t)platform;
+}
+
+inline const char* platformName(Platform platform)
+{
+    static const char* const names[PLATFORM_COUNT] = { "FACEBOOK", "TWITTER", "INSTAGRAM", "LINKEDIN", "SNAPCHAT", "STACKOVERFLOW" };
+    return names[platformIndex(platform)];
+}
+
 // Enum for post status
-enum class PostStatus {
+enum class PostStatus : uint8_t {
     PENDING,
     POSTED,
-    FAILED
+    FAILED,
+    CANCELLED
+};
+
+// Priority classes, most urgent first
+enum class Priority : uint8_t {
+    HIGH,
+    NORMAL,
+    LOW
+};
+
+constexpr size_t PRIORITY_COUNT = 3;
+
+// How PostQueue picks between priority classes
+enum class PriorityMode : uint8_t {
+    STRICT,  // Always the most urgent class that has posts
+    WEIGHTED // Each class in proportion to its weight, so LOW still moves under a flood of HIGH
+};
+
+// Immutable post text, shared by every post made from it
+/*
+* -One buffer (a reference count and length, then the text) from the BytePools
+* -Copying a PostContent only bumps the count, so cross-posting to many platforms copies the text once
+*/
+class PostContent
+{
+private:
+    struct Header
+    {
+        std::atomic<uint32_t> references;
+        uint32_t length;
+    };
+
+    Header* buffer = nullptr;
+
+    const char* text() const { return reinterpret_cast<const char*>(buffer + 1); }
+
+    void release()
+    {
+        if (buffer && buffer->references.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            size_t size = sizeof(Header) + buffer->length;
+            buffer->~Header();
+            BytePool::deallocate(reinterpret_cast<char*>(buffer), size);
+        }
+        buffer = nullptr;
+    }
+
+public:
+    PostContent() = default;
+
+    explicit PostContent(std::string_view content)
+    {
+        char* bytes = BytePool::allocate(sizeof(Header) + content.size());
+        buffer = new (bytes) Header{ { 1 }, (uint32_t)content.size() };
+        content.copy(bytes + sizeof(Header), content.size());
+    }
+
+    PostContent(const PostContent& other)
+        : buffer(other.buffer)
+    {
+        if (buffer) buffer->references.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    PostContent(PostContent&& other) noexcept
+        : buffer(std::exchange(other.buffer, nullptr)) {}
+
+    PostContent& operator=(PostContent other) noexcept
+    {
+        std::swap(buffer, other.buffer);
+        return *this;
+    }
+
+    ~PostContent()
+    {
+        release();
+    }
+
+    std::string_view view() const
+    {
+        return buffer ? std::string_view(text(), buffer->length) : std::string_view();
+    }
+
+    size_t size() const { return buffer ? buffer->length : 0; }
 };
 
 // Class representing a social media post
+/*
+* -A post without a publish time (or with one in the past) is published straight away
+* -Compact: the fields the scheduler touches for every post come first and fit in 32 bytes,
+*  the content is a separate buffer that is only read when the post is published
+* -The content is a PostContent, so a cross-post is one post per platform sharing one copy of the text
+* -Timestamps for PostQueue's latency metrics come last, they are only read when the post completes
+* -Status is atomic, there is no per-post lock
+* -Post::create allocates the post and its content from BlockPools, so making and dropping
+*  posts doesn't go to the heap once the pools are warm
+*/
 class Post
 {
 private:
-    mutable std::mutex postMutex;
-    std::string content;
-    Platform platform;
-    PostStatus status;
+    // Hot
+    std::atomic<PostStatus> status{ PostStatus::PENDING };
+    const Platform platform;
+    const Priority priority;
+    std::atomic<bool> retryable{ false };
+    std::atomic<uint8_t> failedAttempts{ 0 };
+    const TimerService::Clock::time_point publishTime;
+    std::atomic<TimerService::TimerId> timer{ TimerService::NO_TIMER }; // Set while it waits for its publish time
+    WriteAheadLog::RecordId logId = 0; // Its record in a durable PostQueue's log, 0 if it has none
+
+    // Cold
+    const PostContent content;
+
+    // LatencyMetrics::now() when it was added (or came due), taken from the queue and started; 0 until then
+    int64_t enqueuedAt = 0;
+    int64_t dequeuedAt = 0;
+    int64_t startedAt = 0;
 
 public:
-    Post(const std::string& content, Platform platform)
-        : content(content), platform(platform), status(PostStatus::PENDING) {}
+    static constexpr unsigned MAX_ATTEMPTS = 255;
+
+    Post(PostContent content, Platform platform, TimerService::Clock::time_point publishTime = {}, Priority priority = Priority::NORMAL)
+        : platform(platform),
+        priority(priority),
+        publishTime(publishTime),
+        content(std::move(content)) {}
+
+    Post(std::string_view content, Platform platform, TimerService::Clock::time_point publishTime = {}, Priority priority = Priority::NORMAL)
+        : Post(PostContent(content), platform, publishTime, priority) {}
+
+    Post(const Post&) = delete;
+    Post& operator=(const Post&) = delete;
+
+    // Like std::make_shared, but the post (with its reference counts) comes from a pool
+    static std::shared_ptr<Post> create(std::string_view content, Platform platform, TimerService::Clock::time_point publishTime = {}, Priority priority = Priority::NORMAL)
+    {
+        return std::allocate_shared<Post>(PoolAllocator<Post>(), content, platform, publishTime, priority);
+    }
+
+    static std::shared_ptr<Post> create(PostContent content, Platform platform, TimerService::Clock::time_point publishTime = {}, Priority priority = Priority::NORMAL)
+    {
+        return std::allocate_shared<Post>(PoolAllocator<Post>(), std::move(content), platform, publishTime, priority);
+    }
+
+    // One post per platform, all sharing one copy of the content
+    static std::vector<std::shared_ptr<Post>> createCrossPost(std::string_view content, const std::vector<Platform>& platforms, TimerService::Clock::time_point publishTime = {}, Priority priority = Priority::NORMAL)
+    {
+        PostContent shared(content);
+        std::vector<std::shared_ptr<Post>> posts;
+        posts.reserve(platforms.size());
+        for (Platform platform : platforms)
+        {
+            posts.push_back(create(shared, platform, publishTime, priority));
+        }
+        return posts;
+    }
 
     void updateStatus(PostStatus newStatus)
     {
-        postMutex.lock();
-        status = newStatus;
-        postMutex.unlock();
+        status.store(newStatus, std::memory_order_release);
     }
 
-    PostStatus getStatus() const { return status; }
+    PostStatus getStatus() const { return status.load(std::memory_order_acquire); }
 
     Platform getPlatform() const { return platform; }
-    std::string getContent() const { return content; }
+    Priority getPriority() const { return priority; }
+    std::string_view getContent() const { return content.view(); }
+    const PostContent& getSharedContent() const { return content; }
+    TimerService::Clock::time_point getPublishTime() const { return publishTime; }
+
+    void setTimer(TimerService::TimerId id) { timer.store(id); }
+    TimerService::TimerId getTimer() const { return timer.load(); }
+
+    // FAILED, but for a reason that may go away (the platform is down), so it is worth trying again
+    void failTemporarily()
+    {
+        retryable.store(true);
+        updateStatus(PostStatus::FAILED);
+    }
+
+    bool isRetryable() const { return retryable.load(); }
+
+    void markEnqueued(int64_t time) { enqueuedAt = time; }
+    void markDequeued(int64_t time) { dequeuedAt = time; }
+    void markStarted(int64_t time) { startedAt = time; }
+    int64_t getEnqueuedAt() const { return enqueuedAt; }
+    int64_t getDequeuedAt() const { return dequeuedAt; }
+    int64_t getStartedAt() const { return startedAt; }
+
+    void setLogId(WriteAheadLog::RecordId id) { logId = id; }
+    WriteAheadLog::RecordId getLogId() const { return logId; }
+
+    // Log record: [platform u8][priority u8][publish time i64][content]
+    // The publish time is stored as wall-clock nanoseconds (0 for straight away), as the steady clock
+    // doesn't carry over a restart
+    size_t encodedSize() const
+    {
+        return 2 + sizeof(int64_t) + content.size();
+    }
+
+    void encode(char* out) const
+    {
+        int64_t wallTime = 0;
+        TimerService::Clock::time_point now = TimerService::Clock::now();
+        if (publishTime > now)
+        {
+            auto wall = std::chrono::system_clock::now() + std::chrono::duration_cast<std::chrono::system_clock::duration>(publishTime - now);
+            wallTime = std::chrono::duration_cast<std::chrono::nanoseconds>(wall.time_since_epoch()).count();
+        }
+        out[0] = (char)platform;
+        out[1] = (char)priority;
+        std::memcpy(out + 2, &wallTime, sizeof(wallTime));
+        std::memcpy(out + 2 + sizeof(wallTime), content.view().data(), content.size());
+    }
+
+    // Null if the record is malformed
+    static std::shared_ptr<Post> decode(std::string_view record)
+    {
+        if (record.size() < 2 + sizeof(int64_t) || (uint8_t)record[0] >= PLATFORM_COUNT || (uint8_t)record[1] >= PRIORITY_COUNT) return nullptr;
+
+        int64_t wallTime;
+        std::memcpy(&wallTime, record.data() + 2, sizeof(wallTime));
+        TimerService::Clock::time_point publishTime{};
+        if (wallTime != 0)
+        {
+            auto wall = std::chrono::system_clock::time_point(std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::nanoseconds(wallTime)));
+            auto remaining = wall - std::chrono::system_clock::now();
+            if (remaining.count() > 0)
+            {
+                publishTime = TimerService::Clock::now() + std::chrono::duration_cast<TimerService::Clock::duration>(remaining);
+            }
+        }
+        return create(record.substr(2 + sizeof(int64_t)), (Platform)record[0], publishTime, (Priority)record[1]);
+    }
+
+    // Counts a failed attempt and returns how many there have been, ready for another try
+    // Stops counting at MAX_ATTEMPTS
+    unsigned recordFailedAttempt()
+    {
+        retryable.store(false);
+        uint8_t attempts = failedAttempts.load();
+        while (attempts < MAX_ATTEMPTS && !failedAttempts.compare_exchange_weak(attempts, attempts + 1)) {}
+        return attempts < MAX_ATTEMPTS ? attempts + 1u : MAX_ATTEMPTS;
+    }
 
 };
 
 // Thread-safe queue for managing posts
+/*
+* -One lane per platform, each a bounded lock-free ring (MpmcQueue), so a backed-up platform only blocks its own producers
+* -Each lane has a weight and a limit on how many of its posts (or batches) may be in flight at once,
+*  so a slow platform can't take every worker; takers hand them back with finishPost()
+* -A worker has a home lane (workers are spread over lanes by weight) and takes from other lanes,
+*  picked by weight, when its own is empty or at its limit
+* -Idle workers park until a post arrives, a full lane makes addPost wait
+* -Timers never wait on a full lane: a post that comes due then goes to the lane's overflow list, and
+*  workers move it into the ring as room frees up
+* -After shutdown() the remaining posts are still handed out, then getNextPost returns null
+* -Posts with a future publish time wait in a TimerService and only enter a lane when they are due,
+*  so workers never see them early and nothing polls for them
+* -Scheduled posts that are not due by shutdown() are dropped and stay PENDING
+* -A lane can batch: tryGetNextBatch() hands out its posts once maxBatch are waiting, or once the
+*  oldest has waited maxWait (a timer marks the lane due, nothing polls)
+* -A lane can be rate limited with a token bucket (one token per post); a lane out of tokens is
+*  skipped and a timer wakes the workers when the next token is due
+* -retryPost() puts a temporarily failed post back through the same timers, after an exponential
+*  backoff with full jitter so retries of a platform that went down don't all arrive together
+*  (a retry that comes after shutdown() is left PENDING, so a durable queue tries it again on the next start)
+* -Optionally durable (enableDurability): every added post is appended to a WriteAheadLog and only
+*  reaches a lane (or the timers) once its record is on disk, final statuses are logged as small
+*  records, and whatever was still pending is put back in the queue on the next start.
+*  The log's flusher hands posts on like a timer and never waits on a lane; addPost waits for room
+*  in the lane before it logs a post instead.
+* -Optionally deduplicating (configureDeduplication): addPost turns away a post whose platform and
+*  content hash the same as one added within the window, before it takes a lane slot or a log record
+* -Optionally prioritized (configurePriorities): each lane gets one ring per Priority, taken from
+*  strictly by priority or by weight; without it every post goes in the one ring and nothing changes
+* -Latency metrics per platform (LatencyMetrics, sharded per thread): time queued (added or due until
+*  taken), dispatch (taken until processing starts), processing and end-to-end, plus outcome counters;
+*  metricsReport() on demand, reportMetricsEvery() to print it while there is traffic
+*/
 class PostQueue
 {
+public:
+    static constexpr size_t NO_LANE = SIZE_MAX;
+
 private:
-    std::mutex queueMutex;
-    std::condition_variable queueCV;
-    std::deque<std::shared_ptr<Post>> posts;
-    bool shutDown{ false };
+    typedef MpmcQueue<std::shared_ptr<Post>> Ring;
+
+    struct Lane
+    {
+        Ring posts; // NORMAL, and every post while the queue has no priorities
+        std::array<Ring*, PRIORITY_COUNT> classes; // The ring for each priority
+        std::vector<std::unique_ptr<Ring>> extraClasses;
+        std::atomic<size_t> classCursor{ 0 };
+        std::atomic<size_t> inFlight{ 0 };
+        size_t maxInFlight = SIZE_MAX;
+        unsigned weight = 1;
+        size_t maxBatch = 1;
+        std::chrono::milliseconds maxWait{ 0 };
+        std::atomic<bool> timerArmed{ false };
+        std::atomic<bool> flushDue{ false }; // The oldest post has waited maxWait
+        std::unique_ptr<TokenBucket> rateLimit;
+        std::atomic<bool> throttleArmed{ false };
+        unsigned maxAttempts = 5;
+        std::chrono::milliseconds retryBase{ 250 };
+        std::chrono::milliseconds retryCap{ 30000 };
+        std::mutex overflowMutex;
+        std::deque<std::shared_ptr<Post>> overflow; // Due posts that found the ring full, oldest first
+        std::atomic<size_t> overflowed{ 0 };        // Its size, read without the lock
+        std::atomic<size_t> admitting{ 0 };         // Due posts logged but not yet released, they have room set aside
+        Parker room;                                // Durable producers waiting for room, woken as posts are taken
+
+        explicit Lane(size_t capacity)
+            : posts(capacity)
+        {
+            classes.fill(&posts);
+        }
+    };
+
+    std::vector<std::unique_ptr<Lane>> lanes;
+    std::vector<size_t> laneOrder;           // Every lane `weight` times, interleaved
+    std::atomic<size_t> stealCursor{ 0 };
+    std::atomic<bool> closed{ false };
+    const size_t laneCapacity;
+    bool prioritized = false;
+    PriorityMode priorityMode = PriorityMode::STRICT;
+    std::vector<uint8_t> classOrder; // WEIGHTED: every class `weight` times, interleaved
+
+    enum MetricStage : size_t {
+        STAGE_QUEUED,
+        STAGE_DISPATCH,
+        STAGE_PROCESSING,
+        STAGE_END_TO_END,
+        STAGE_COUNT
+    };
+
+    enum MetricCounter : size_t {
+        COUNT_POSTED,
+        COUNT_FAILED,
+        COUNT_RETRIED,
+        COUNT_UNFINISHED, // Would have been retried but the queue shut down, left PENDING
+        COUNTER_COUNT
+    };
+
+    LatencyMetrics latency{ PLATFORM_COUNT, STAGE_COUNT, COUNTER_COUNT };
+    std::mutex reportMutex;
+    int64_t lastReportAt = LatencyMetrics::now();
+    std::array<uint64_t, PLATFORM_COUNT> lastCompleted{}; // Posted and failed, at the last report
+    Parker available;
+    std::atomic<Parker*> consumers{ nullptr }; // Woken as well, for consumers that also wait on other work
+    std::atomic<size_t> wakingConsumers{ 0 };  // Wakes that may still be using `consumers`, see wakeOnPost
+    TimerService scheduled; // After the lanes, so its thread stops before they go away
+    std::unique_ptr<DuplicateFilter> duplicates;
+    std::unique_ptr<WriteAheadLog> log; // Last, its flusher hands posts to the lanes and the timers
+
+    enum LogRecord : uint8_t {
+        LOG_POST = 1,   // A post was added
+        LOG_STATUS = 2  // [log id u64][status u8]: a post reached a final status
+    };
+
 public:
-    void addPost(std::shared_ptr<Post> post)
+    // `capacity` is per lane
+    explicit PostQueue(size_t capacity = 4096)
+        : laneCapacity(capacity)
     {
-        queueMutex.lock();
-        posts.push_front(post); // Proper transfer of shared ptr?
-        queueMutex.unlock();
-        queueCV.notify_all();
+        for (size_t i = 0; i < PLATFORM_COUNT; i++)
+        {
+            lanes.push_back(std::make_unique<Lane>(capacity));
+        }
+        buildLaneOrder();
+    }
+
+    // Set before any worker starts taking posts
+    void configureLane(Platform platform, unsigned weight, size_t maxInFlight = SIZE_MAX)
+    {
+        Lane& lane = *lanes[platformIndex(platform)];
+        lane.weight = weight > 0 ? weight : 1;
+        lane.maxInFlight = maxInFlight > 0 ? maxInFlight : 1;
+        buildLaneOrder();
+    }
+
+    // Set before any worker starts taking posts. A maxBatch of 1 turns batching off.
+    void configureBatching(Platform platform, size_t maxBatch, std::chrono::milliseconds maxWait)
+    {
+        Lane& lane = *lanes[platformIndex(platform)];
+        lane.maxBatch = maxBatch > 0 ? maxBatch : 1;
+        lane.maxWait = maxWait;
+    }
+
+    // Set before any worker starts taking posts. At most `postsPerSecond` on average, `burst` at once after a quiet spell.
+    void configureRateLimit(Platform platform, double postsPerSecond, size_t burst)
+    {
+        lanes[platformIndex(platform)]->rateLimit = std::make_unique<TokenBucket>(postsPerSecond, burst);
+    }
+
+    // Set before any worker starts taking posts
+    // Attempt n waits a random time up to min(cap, base * 2^(n-1)); after maxAttempts the post stays FAILED
+    void configureRetry(Platform platform, unsigned maxAttempts, std::chrono::milliseconds base, std::chrono::milliseconds cap)
+    {
+        Lane& lane = *lanes[platformIndex(platform)];
+        lane.maxAttempts = std::min(maxAttempts, Post::MAX_ATTEMPTS);
+        lane.retryBase = base;
+        lane.retryCap = cap;
+    }
+
+    // Set before adding posts. Gives every lane a ring per Priority; WEIGHTED takes from HIGH, NORMAL and LOW
+    // in proportion to `weights`, STRICT ignores them
+    void configurePriorities(PriorityMode mode, std::array<unsigned, PRIORITY_COUNT> weights = { 4, 2, 1 })
+    {
+        prioritized = true;
+        priorityMode = mode;
+        for (auto& lane : lanes)
+        {
+            lane->extraClasses.clear();
+            for (size_t i = 0; i < PRIORITY_COUNT; i++)
+            {
+                if (i == (size_t)Priority::NORMAL) continue;
+                lane->extraClasses.push_back(std::make_unique<Ring>(laneCapacity));
+                lane->classes[i] = lane->extraClasses.back().get();
+            }
+        }
+
+        unsigned total = 0;
+        for (unsigned& weight : weights) total += weight = std::max(weight, 1u);
+        std::array<long, PRIORITY_COUNT> current{};
+        classOrder.clear();
+        for (unsigned step = 0; step < total; step++)
+        {
+            size_t best = 0;
+            for (size_t i = 0; i < PRIORITY_COUNT; i++)
+            {
+                current[i] += weights[i];
+                if (current[i] > current[best]) best = i;
+            }
+            current[best] -= total;
+            classOrder.push_back((uint8_t)best);
+        }
+    }
 
+    // Set before adding posts. Turn away posts that repeat (platform and content) one added less than `window` ago.
+    void configureDeduplication(std::chrono::milliseconds window)
+    {
+        duplicates = std::make_unique<DuplicateFilter>(window);
     }
 
+    // Keep posts in a write-ahead log in `directory`, and put back the ones an earlier run left pending
+    // Call once, before adding posts; like addPost, waits if a lane is full. Returns how many posts came back.
+    size_t enableDurability(const std::string& directory, const WriteAheadLog::Options& options = {})
+    {
+        log = std::make_unique<WriteAheadLog>(directory, options);
+
+        std::unordered_map<WriteAheadLog::RecordId, std::shared_ptr<Post>> pending;
+        log->replay([&](WriteAheadLog::RecordId id, uint8_t type, std::string_view payload) {
+            if (type == LOG_POST)
+            {
+                if (std::shared_ptr<Post> post = Post::decode(payload))
+                {
+                    post->setLogId(id);
+                    pending.emplace(id, std::move(post));
+                }
+            }
+            else if (type == LOG_STATUS && payload.size() == sizeof(uint64_t) + 1)
+            {
+                WriteAheadLog::RecordId postId;
+                std::memcpy(&postId, payload.data(), sizeof(postId));
+                pending.erase(postId);
+            }
+            });
+
+        std::vector<std::shared_ptr<Post>> recovered;
+        recovered.reserve(pending.size());
+        for (auto& entry : pending)
+        {
+            log->retain(entry.first);
+            recovered.push_back(std::move(entry.second));
+        }
+        log->start();
+
+        std::sort(recovered.begin(), recovered.end(), [](const auto& a, const auto& b) { return a->getLogId() < b->getLogId(); });
+        int64_t now = LatencyMetrics::now();
+        for (auto& post : recovered)
+        {
+            post->markEnqueued(now);
+            admit(std::move(post), true);
+        }
+        return recovered.size();
+    }
+
+    // Waits until every post added so far is on disk (and so has been handed to the workers)
+    void syncLog()
+    {
+        if (log) log->sync();
+    }
+
+    // Which lane worker `worker` should favour
+    size_t homeLane(size_t worker) const
+    {
+        return laneOrder[worker % laneOrder.size()];
+    }
+
+    // Returns false if the queue has been shut down, or if the post is a duplicate (it is then CANCELLED)
+    // In a durable queue it returns once the post is in the log's buffer (waiting for room in the lane first,
+    // if the post is due), the post follows once it is on disk
+    bool addPost(std::shared_ptr<Post> post)
+    {
+        if (closed.load()) return false;
+        if (duplicates && !duplicates->insert(DuplicateFilter::hash(post->getContent(), (uint64_t)post->getPlatform())))
+        {
+            post->updateStatus(PostStatus::CANCELLED);
+            return false;
+        }
+        post->markEnqueued(LatencyMetrics::now());
+        if (!log) return admit(std::move(post), true);
+
+        Lane& lane = *lanes[platformIndex(post->getPlatform())];
+        bool due = post->getPublishTime() <= TimerService::Clock::now();
+        if (due && !waitForRoom(lane, *lane.classes[(size_t)post->getPriority()])) return false;
+
+        Post* raw = post.get();
+        log->append(LOG_POST, raw->encodedSize(), [raw](WriteAheadLog::RecordId id, char* out) {
+            raw->setLogId(id);
+            raw->encode(out);
+            }, true, [this, &lane, due, post = std::move(post)]() mutable {
+                admit(std::move(post), false); // On the flusher, which every platform's posts wait for
+                if (due) lane.admitting.fetch_sub(1);
+            });
+        return true;
+    }
+
+    // Every post taken from the queue comes back here once it has been published
+    // A temporary failure is retried while it has attempts left. If the queue has shut down meanwhile it is left
+    // PENDING and unsettled, like a post still waiting out its backoff, so a durable queue tries it again on the
+    // next start. Anything else is final.
+    void completePost(std::shared_ptr<Post> post)
+    {
+        size_t platform = platformIndex(post->getPlatform());
+        recordLatency(platform, *post);
+        if (post->isRetryable() && retryPost(post))
+        {
+            latency.count(platform, COUNT_RETRIED);
+            return;
+        }
+        if (post->getStatus() == PostStatus::PENDING)
+        {
+            latency.count(platform, COUNT_UNFINISHED);
+            return;
+        }
+        latency.count(platform, post->getStatus() == PostStatus::POSTED ? COUNT_POSTED : COUNT_FAILED);
+        settle(*post);
+    }
+
+    // One line per platform that has had posts: outcomes, throughput since the last report, and latency
+    // percentiles in ms for each stage
+    std::string metricsReport()
+    {
+        std::lock_guard<std::mutex> lock(reportMutex);
+        int64_t now = LatencyMetrics::now();
+        double seconds = std::max(1e-9, (now - lastReportAt) / 1e9);
+        lastReportAt = now;
+
+        static const char* const stageNames[STAGE_COUNT] = { "queued", "dispatch", "processing", "end-to-end" };
+        std::string report;
+        for (size_t i = 0; i < PLATFORM_COUNT; i++)
+        {
+            uint64_t posted = latency.counter(i, COUNT_POSTED);
+            uint64_t failed = latency.counter(i, COUNT_FAILED);
+            uint64_t retried = latency.counter(i, COUNT_RETRIED);
+            uint64_t unfinished = latency.counter(i, COUNT_UNFINISHED);
+            uint64_t completed = posted + failed;
+            uint64_t recent = completed - lastCompleted[i];
+            lastCompleted[i] = completed;
+            if (completed == 0 && retried == 0 && unfinished == 0) continue;
+
+            char line[256];
+            snprintf(line, sizeof(line), "Posts %s: %llu posted, %llu failed, %llu retried, %llu unfinished (%.2f posts/s)",
+                platformName((Platform)i), (unsigned long long)posted, (unsigned long long)failed,
+                (unsigned long long)retried, (unsigned long long)unfinished, recent / seconds);
+            report += line;
+            for (size_t stage = 0; stage < STAGE_COUNT; stage++)
+            {
+                LatencyMetrics::Histogram histogram = latency.histogram(i, stage);
+                snprintf(line, sizeof(line), " | %s p50 %.2f p90 %.2f p99 %.2f p99.9 %.2f max %.2f ms",
+                    stageNames[stage], histogram.percentile(0.50), histogram.percentile(0.90), histogram.percentile(0.99),
+                    histogram.percentile(0.999), histogram.maxNanoseconds / 1e6);
+                report += line;
+            }
+            report += '\n';
+        }
+        return report;
+    }
+
+    // Print metricsReport() every `interval`, whenever posts completed since the last report, until shutdown
+    void reportMetricsEvery(std::chrono::milliseconds interval)
+    {
+        scheduled.schedule(TimerService::Clock::now() + interval, [this, interval]() {
+            if (closed.load()) return;
+            if (completedSinceReport())
+            {
+                std::osyncstream(std::cout) << metricsReport();
+            }
+            reportMetricsEvery(interval);
+            });
+    }
+
+    // Queue a post that failed temporarily again, after a backoff. It is PENDING again while it waits.
+    // Returns false if it is out of attempts (the post stays FAILED) or the queue has been shut down
+    // (it is PENDING, but nothing will try it again in this run).
+    bool retryPost(std::shared_ptr<Post> post)
+    {
+        Lane& lane = *lanes[platformIndex(post->getPlatform())];
+        unsigned attempts = post->recordFailedAttempt();
+        if (attempts >= lane.maxAttempts) return false;
+        if (closed.load())
+        {
+            post->updateStatus(PostStatus::PENDING);
+            return false;
+        }
+
+        // Full jitter: anywhere between now and the exponential ceiling
+        std::chrono::milliseconds ceiling = std::min<std::chrono::milliseconds>(lane.retryCap, lane.retryBase * (1LL << std::min(attempts - 1, 20u)));
+        thread_local std::minstd_rand random(std::random_device{}());
+        std::uniform_int_distribution<long long> jitter(0, ceiling.count());
+        auto delay = std::chrono::milliseconds(jitter(random));
+
+        post->updateStatus(PostStatus::PENDING);
+        hold(std::move(post), TimerService::Clock::now() + delay);
+        return true;
+    }
+
+    // Takes back a post that is still waiting for its publish time
+    // Returns false if it was already released to the workers (or was never scheduled)
+    bool cancelPost(const std::shared_ptr<Post>& post)
+    {
+        if (!scheduled.cancel(post->getTimer())) return false;
+        post->updateStatus(PostStatus::CANCELLED);
+        settle(*post);
+        return true;
+    }
+
+    // Posts still waiting for their publish time
+    size_t scheduledCount()
+    {
+        return scheduled.pending();
+    }
+
+    // Every post (or batch) taken from the queue has to come back here once it is done with
+    void finishPost(Platform platform)
+    {
+        Lane& lane = *lanes[platformIndex(platform)];
+        if (lane.inFlight.fetch_sub(1) == lane.maxInFlight) // The lane was held back, it may have posts waiting
+        {
+            wakeConsumers();
+        }
+    }
+
+    // Also wake `parker` whenever a post may be ready, null to stop. Timers wake it from their own thread,
+    // so this waits for any wake already using the old one: once it returns, the old one can be destroyed.
+    void wakeOnPost(Parker* parker)
+    {
+        consumers.store(parker);
+        while (wakingConsumers.load() != 0)
+        {
+            std::this_thread::yield();
+        }
+    }
+
+    // Waits for the next post. Returns null once the queue is shut down and empty.
     std::shared_ptr<Post> getNextPost()
     {
-        std::lock_guard<std::mutex> sharepost(queueMutex);
+        return waitForPost(false, {});
+    }
+
+    // Null if there is no post right now. Tries `home` first, then the other lanes.
+    std::shared_ptr<Post> tryGetNextPost(size_t home = NO_LANE)
+    {
+        std::shared_ptr<Post> post;
+        if (home != NO_LANE && tryTakeOne(*lanes[home], post))
+        {
+            return post;
+        }
 
-        std::shared_ptr<Post> post = posts[posts.size()-1];
-        posts.pop_back();
-        return post;
+        size_t first = laneOrder[stealCursor.fetch_add(1, std::memory_order_relaxed) % laneOrder.size()];
+        for (size_t i = 0; i < lanes.size(); i++)
+        {
+            size_t index = (first + i) % lanes.size();
+            if (index != home && tryTakeOne(*lanes[index], post))
+            {
+                return post;
+            }
+        }
+        return nullptr;
+    }
+
+    // Like tryGetNextPost, but takes a whole batch from one lane, once that lane's batch is ready
+    // Lanes without batching give batches of one. Returns false (and leaves `batch` empty) if nothing is ready.
+    bool tryGetNextBatch(size_t home, std::vector<std::shared_ptr<Post>>& batch)
+    {
+        if (home != NO_LANE && tryTakeBatch(*lanes[home], batch))
+        {
+            return true;
+        }
+
+        size_t first = laneOrder[stealCursor.fetch_add(1, std::memory_order_relaxed) % laneOrder.size()];
+        for (size_t i = 0; i < lanes.size(); i++)
+        {
+            size_t index = (first + i) % lanes.size();
+            if (index != home && tryTakeBatch(*lanes[index], batch))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Null if no post arrived within the timeout
+    std::shared_ptr<Post> getNextPostFor(std::chrono::milliseconds timeout)
+    {
+        return waitForPost(true, std::chrono::steady_clock::now() + timeout);
     }
 
     void shutdown()
     {
+        closed.store(true);
+        for (auto& lane : lanes)
         {
-            std::lock_guard<std::mutex> sharepost(queueMutex);
-            shutDown = true;
+            lane->posts.close();
+            for (auto& ring : lane->extraClasses) ring->close();
         }
-        queueCV.notify_all();
+        available.notifyAll();
+        notifyConsumers(true);
+        for (auto& lane : lanes) lane->room.notifyAll();
     }
 
+    // Only counts posts that are due
     bool isEmpty()
     {
-        return posts.empty();
+        for (auto& lane : lanes)
+        {
+            if (!isEmpty(*lane)) return false;
+        }
+        return true;
+    }
+
+private:
+    // Due posts go to a lane, future ones to the timers. `wait` as for release().
+    bool admit(std::shared_ptr<Post> post, bool wait)
+    {
+        TimerService::Clock::time_point publishTime = post->getPublishTime();
+        if (publishTime > TimerService::Clock::now())
+        {
+            hold(std::move(post), publishTime);
+            return true;
+        }
+        return release(std::move(post), wait);
+    }
+
+    // Time in each stage of an attempt that has just finished processing
+    void recordLatency(size_t platform, const Post& post)
+    {
+        int64_t enqueued = post.getEnqueuedAt(), dequeued = post.getDequeuedAt(), started = post.getStartedAt();
+        if (enqueued == 0 || dequeued == 0 || started == 0) return;
+
+        int64_t now = LatencyMetrics::now();
+        latency.record(platform, STAGE_QUEUED, dequeued - enqueued);
+        latency.record(platform, STAGE_DISPATCH, started - dequeued);
+        latency.record(platform, STAGE_PROCESSING, now - started);
+        latency.record(platform, STAGE_END_TO_END, now - enqueued);
+    }
+
+    bool completedSinceReport()
+    {
+        std::lock_guard<std::mutex> lock(reportMutex);
+        for (size_t i = 0; i < PLATFORM_COUNT; i++)
+        {
+            if (latency.counter(i, COUNT_POSTED) + latency.counter(i, COUNT_FAILED) != lastCompleted[i]) return true;
+        }
+        return false;
+    }
+
+    // Log a final status; the post's record is no longer needed
+    void settle(const Post& post)
+    {
+        if (!log || post.getLogId() == 0) return;
+
+        WriteAheadLog::RecordId id = post.getLogId();
+        PostStatus status = post.getStatus();
+        log->append(LOG_STATUS, sizeof(id) + 1, [id, status](WriteAheadLog::RecordId, char* out) {
+            std::memcpy(out, &id, sizeof(id));
+            out[sizeof(id)] = (char)status;
+            }, false);
+        log->discard(id);
+    }
+
+    // Keep a post in the timer service until `time`
+    void hold(std::shared_ptr<Post> post, TimerService::Clock::time_point time)
+    {
+        Post* raw = post.get();
+        raw->setTimer(scheduled.schedule(time, [this, post = std::move(post)]() mutable {
+            post->markEnqueued(LatencyMetrics::now()); // Its queueing starts when it comes due
+            release(std::move(post), false); // Every other timer waits behind this one, so never block
+            }));
+    }
+
+    // Hand a due post to the workers. With `wait` (a producer) a full lane makes it wait. Without (a timer)
+    // it goes to the lane's overflow instead, behind anything already there. False once the queue is shut down.
+    bool release(std::shared_ptr<Post> post, bool wait)
+    {
+        Lane& lane = *lanes[platformIndex(post->getPlatform())];
+        Ring& ring = *lane.classes[(size_t)post->getPriority()];
+        if (wait)
+        {
+            if (!ring.push(std::move(post))) return false;
+        }
+        else if (closed.load())
+        {
+            return false;
+        }
+        else if (lane.overflowed.load() != 0 || !ring.tryPush(post))
+        {
+            std::lock_guard<std::mutex> lock(lane.overflowMutex);
+            lane.overflow.push_back(std::move(post));
+            lane.overflowed.fetch_add(1);
+        }
+
+        if (lane.maxBatch > 1 && !lane.timerArmed.exchange(true))
+        {
+            // Start the clock for this batch; it is cut short if the batch fills first
+            scheduled.schedule(TimerService::Clock::now() + lane.maxWait, [this, &lane]() {
+                lane.timerArmed.store(false);
+                lane.flushDue.store(true);
+                wakeConsumers();
+                });
+        }
+        if (lane.maxBatch == 1 || sizeApprox(lane) >= lane.maxBatch)
+        {
+            wakeConsumers();
+        }
+        return true;
+    }
+
+    void wakeConsumers()
+    {
+        available.notifyOne();
+        notifyConsumers(false);
+    }
+
+    // Announced in wakingConsumers before `consumers` is read, so wakeOnPost can tell when nobody still has it
+    // (both sequentially consistent: a wake that read the old Parker has announced itself before it was replaced)
+    void notifyConsumers(bool all)
+    {
+        wakingConsumers.fetch_add(1);
+        if (Parker* parker = consumers.load())
+        {
+            if (all) parker->notifyAll();
+            else parker->notifyOne();
+        }
+        wakingConsumers.fetch_sub(1);
+    }
+
+    // Wait until the ring has room for one more, counting what is overflowed or on its way from the log,
+    // and set that room aside. False once the queue is shut down.
+    // Producers that check at the same time can both get the last place, the overflow takes the excess.
+    bool waitForRoom(Lane& lane, const Ring& ring)
+    {
+        auto full = [&lane, &ring] { return ring.sizeApprox() + lane.overflowed.load() + lane.admitting.load() >= ring.capacity(); };
+        while (full())
+        {
+            if (closed.load()) return false;
+            uint32_t key = lane.room.prepareWait();
+            if (!full() || closed.load())
+            {
+                lane.room.cancelWait();
+                continue;
+            }
+            lane.room.wait(key);
+        }
+        if (closed.load()) return false;
+        lane.admitting.fetch_add(1);
+        return true;
+    }
+
+    // Move overflowed posts into their rings, oldest first, while there is room
+    // Only one worker at a time, the others carry on with what is already in the rings
+    void drainOverflow(Lane& lane)
+    {
+        std::unique_lock<std::mutex> lock(lane.overflowMutex, std::try_to_lock);
+        if (!lock.owns_lock()) return;
+        while (!lane.overflow.empty() && lane.classes[(size_t)lane.overflow.front()->getPriority()]->tryPush(lane.overflow.front()))
+        {
+            lane.overflow.pop_front();
+            lane.overflowed.fetch_sub(1);
+        }
+    }
+
+    // Without priorities these are just the one ring, plus the overflow
+    bool isEmpty(const Lane& lane) const
+    {
+        if (lane.overflowed.load() != 0) return false;
+        if (!prioritized) return lane.posts.isEmpty();
+        for (Ring* ring : lane.classes)
+        {
+            if (!ring->isEmpty()) return false;
+        }
+        return true;
+    }
+
+    size_t sizeApprox(const Lane& lane) const
+    {
+        size_t size = lane.overflowed.load();
+        if (!prioritized) return size + lane.posts.sizeApprox();
+        for (Ring* ring : lane.classes) size += ring->sizeApprox();
+        return size;
+    }
+
+    bool tryPop(Lane& lane, std::shared_ptr<Post>& post)
+    {
+        if (!prioritized) return lane.posts.tryPop(post);
+
+        // WEIGHTED starts at the class whose turn it is; either way the rest are tried most urgent first
+        size_t first = 0;
+        if (priorityMode == PriorityMode::WEIGHTED)
+        {
+            first = classOrder[lane.classCursor.fetch_add(1, std::memory_order_relaxed) % classOrder.size()];
+            if (lane.classes[first]->tryPop(post)) return true;
+        }
+        for (size_t i = 0; i < PRIORITY_COUNT; i++)
+        {
+            if ((i != first || priorityMode == PriorityMode::STRICT) && lane.classes[i]->tryPop(post)) return true;
+        }
+        return false;
+    }
+
+    // Claim an in-flight place first, so the limit holds exactly
+    static bool claim(Lane& lane)
+    {
+        if (lane.inFlight.fetch_add(1) >= lane.maxInFlight)
+        {
+            lane.inFlight.fetch_sub(1);
+            return false;
+        }
+        return true;
+    }
+
+    // How many of `wanted` posts the rate limit lets through now. With none, the workers are
+    // woken again when the next token is due.
+    size_t takeTokens(Lane& lane, size_t wanted)
+    {
+        if (!lane.rateLimit) return wanted;
+
+        TokenBucket::Clock::duration retryIn{};
+        size_t granted = lane.rateLimit->tryAcquire(wanted, retryIn);
+        if (granted == 0 && !lane.throttleArmed.exchange(true))
+        {
+            scheduled.schedule(TimerService::Clock::now() + retryIn, [this, &lane]() {
+                lane.throttleArmed.store(false);
+                wakeConsumers();
+                });
+        }
+        return granted;
+    }
+
+    bool tryTakeOne(Lane& lane, std::shared_ptr<Post>& post)
+    {
+        if (lane.overflowed.load(std::memory_order_relaxed) != 0) drainOverflow(lane);
+        if (isEmpty(lane) || !claim(lane)) return false;
+        if (takeTokens(lane, 1) == 0)
+        {
+            lane.inFlight.fetch_sub(1);
+            return false;
+        }
+        if (!tryPop(lane, post))
+        {
+            if (lane.rateLimit) lane.rateLimit->refund(1);
+            lane.inFlight.fetch_sub(1);
+            return false;
+        }
+        post->markDequeued(LatencyMetrics::now());
+        lane.room.notifyAll();
+        return true;
+    }
+
+    bool tryTakeBatch(Lane& lane, std::vector<std::shared_ptr<Post>>& batch)
+    {
+        if (lane.overflowed.load(std::memory_order_relaxed) != 0) drainOverflow(lane);
+        if (isEmpty(lane)) return false;
+
+        bool due = lane.maxBatch == 1 || lane.flushDue.load() || closed.load()
+            || sizeApprox(lane) >= lane.maxBatch;
+        if (!due) return false;
+
+        if (!claim(lane)) return false; // The whole batch is one call to the platform
+
+        size_t allowed = takeTokens(lane, std::min(lane.maxBatch, sizeApprox(lane)));
+        std::shared_ptr<Post> post;
+        while (batch.size() < allowed && tryPop(lane, post))
+        {
+            batch.push_back(std::move(post));
+        }
+        if (!batch.empty())
+        {
+            int64_t now = LatencyMetrics::now();
+            for (auto& taken : batch) taken->markDequeued(now);
+            lane.room.notifyAll();
+        }
+        if (lane.rateLimit && batch.size() < allowed)
+        {
+            lane.rateLimit->refund(allowed - batch.size());
+        }
+
+        // Anything left behind is at least as old as what we took, so the lane stays due
+        if (lane.flushDue.load() && isEmpty(lane))
+        {
+            lane.flushDue.store(false);
+        }
+        if (batch.empty())
+        {
+            lane.inFlight.fetch_sub(1);
+            return false;
+        }
+        return true;
+    }
+
+    std::shared_ptr<Post> waitForPost(bool timed, std::chrono::steady_clock::time_point deadline)
+    {
+        while (true)
+        {
+            if (std::shared_ptr<Post> post = tryGetNextPost()) return post;
+            if (closed.load() && isEmpty()) return nullptr;
+
+            uint32_t key = available.prepareWait();
+            if (std::shared_ptr<Post> post = tryGetNextPost())
+            {
+                available.cancelWait();
+                return post;
+            }
+            if (closed.load() && isEmpty())
+            {
+                available.cancelWait();
+                return nullptr;
+            }
+            if (!timed)
+            {
+                available.wait(key);
+            }
+            else if (!available.waitUntil(key, deadline))
+            {
+                return tryGetNextPost();
+            }
+        }
+    }
+
+    // Smooth weighted round robin, so a heavy lane is spread out rather than bunched together
+    void buildLaneOrder()
+    {
+        unsigned total = 0;
+        for (auto& lane : lanes) total += lane->weight;
+
+        std::vector<long> current(lanes.size(), 0);
+        laneOrder.clear();
+        for (unsigned step = 0; step < total; step++)
+        {
+            size_t best = 0;
+            for (size_t i = 0; i < lanes.size(); i++)
+            {
+                current[i] += lanes[i]->weight;
+                if (current[i] > current[best]) best = i;
+            }
+            current[best] -= total;
+            laneOrder.push_back(best);
+        }
     }
 
 };
 
 // Class to manage social media platform operations
+/*
+* -processPost is a coroutine: while it waits on the platform it is suspended and holds no thread
+* -Once attached to an executor and a timer service the wait is a timer, otherwise it blocks as before
+* -processBatch sends many posts in one platform call, each post still gets its own status
+*/
 class PlatformManager
 {
 private:
     std::atomic<bool> isActive{ true };
     Platform platformType;
+    Executor* executor = nullptr;
+    TimerService* timers = nullptr;
 
 public:
     PlatformManager(Platform type)
         :platformType(type) {}
 
-    void processPost(std::shared_ptr<Post> post)
+    // Where processPost continues after it has waited
+    void attach(Executor& executor, TimerService& timers)
     {
-        std::osyncstream syncOut(std::cout);
+        this->executor = &executor;
+        this->timers = &timers;
+    }
 
+    AsyncTask processPost(std::shared_ptr<Post> post)
+    {
+        post->markStarted(LatencyMetrics::now());
         if (!isActive) //Don't post if we're in downtime
         {
-            post->updateStatus(PostStatus::FAILED);
-            syncOut << "Post failed: Server is in downtime" << std::endl;
-            return;
+            post->failTemporarily();
+            std::osyncstream(std::cout) << "Post failed: Server is in downtime" << std::endl;
+            co_return;
         }
 
-        std::this_thread::sleep_for(std::chrono::seconds(1));
+        co_await callPlatform();
+
+        std::osyncstream syncOut(std::cout);
+        publish(*post, syncOut);
+    }
 
-        if (post->getPlatform() == platformType) //Only process if the post is on our platform
+    AsyncTask processBatch(std::vector<std::shared_ptr<Post>> batch)
+    {
+        int64_t started = LatencyMetrics::now();
+        for (auto& post : batch) post->markStarted(started);
+        if (!isActive)
         {
-            post->updateStatus(PostStatus::POSTED);
-            syncOut << "Platform: " << getPlatformName() << " Posted: " << post->getContent() << std::endl;
+            std::osyncstream syncOut(std::cout);
+            for (auto& post : batch)
+            {
+                post->failTemporarily();
+                syncOut << "Post failed: Server is in downtime" << std::endl;
+            }
+            co_return;
         }
-        else
+
+        co_await callPlatform(); // One call for the whole batch
+
+        std::osyncstream syncOut(std::cout);
+        for (auto& post : batch)
         {
-            post->updateStatus(PostStatus::FAILED);
-            syncOut << "FAILED: Wrong platform" << std::endl;
+            publish(*post, syncOut);
         }
+    }
 
+private:
+    // Stands in for the call to the platform
+    AsyncTask callPlatform()
+    {
+        if (executor && timers)
+        {
+            co_await sleepFor(*executor, *timers, std::chrono::seconds(1));
+        }
+        else
+        {
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+        }
+    }
 
-
+    void publish(Post& post, std::ostream& syncOut)
+    {
+        if (post.getPlatform() == platformType) //Only process if the post is on our platform
+        {
+            post.updateStatus(PostStatus::POSTED);
+            syncOut << "Platform: " << getPlatformName() << " Posted: " << post.getContent() << std::endl;
+        }
+        else
+        {
+            post.updateStatus(PostStatus::FAILED);
+            syncOut << "FAILED: Wrong platform" << std::endl;
+        }
     }
 
+public:
     void togglePlatform()
     {
         isActive.store(!isActive.load());
@@ -169,44 +1263,524 @@ public:
 };
 
 // ThreadPool class
-class ThreadPool
+/*
+* -Work stealing: every worker owns a Chase-Lev deque, work submitted by a worker stays on its own deque
+* -Work from other threads goes through one MPMC injection queue
+* -A worker with nothing to do steals from random victims, then takes the next post (its home lane first), then parks
+* -Posts are the pool's background work: they are only taken when there is nothing else to run
+* -Work is a move-only Task, small lambdas are stored inline and the nodes are recycled
+* -Posts run as coroutines: a worker starts one and moves on while it waits, up to MAX_POSTS_IN_FLIGHT at once
+* -Posts that fail while their platform is down go back to the queue to be retried
+* -Sizing: with minThreads < maxThreads a monitor thread samples the load and starts workers while there is
+*  queued work and no worker is idle, if workers are stuck in one job (blocked) or, up to the core count,
+*  if jobs wait longer than targetLatency;
+*  workers above the minimum that stay parked for idleTimeout exit
+*/
+class ThreadPool : public Executor
 {
 private:
-    std::vector<std::thread> workers;
-    PostQueue& postQueue;
-    std::unordered_map<Platform, PlatformManager*>& platformManagers;
-    std::atomic<bool> stop;
+    typedef TaskNode Job;
+
+public:
+    // How many workers to run
+    struct Sizing
+    {
+        size_t minThreads = 1;
+        size_t maxThreads = 1;
+        std::chrono::milliseconds idleTimeout{ 10000 };  // A worker above the minimum exits after parking this long
+        std::chrono::milliseconds sampleInterval{ 50 };  // How often the monitor looks at the load
+        std::chrono::microseconds targetLatency{ 2000 }; // Longest a submitted job should wait to start
+    };
+
+private:
+    // One slot per possible worker; a slot without a running thread just has an empty deque
+    struct alignas(64) Worker
+    {
+        WorkStealingDeque<Job*> jobs;
+        std::vector<std::shared_ptr<Post>> batch; // Reused for single posts, so they don't allocate
+        std::thread thread;
+        std::atomic<bool> running{ false };
+        std::atomic<bool> parked{ false };
+        std::atomic<uint64_t> progress{ 0 }; // Jobs finished, to tell a blocked worker from a busy one
+        uint64_t lastProgress = 0;           // Monitor only
+    };
+
+    Sizing sizing;
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::atomic<size_t> liveWorkers{ 0 };
+    MpmcQueue<Job*> injected{ 1 << 16 };
+    Parker idle;
+    std::atomic<size_t> searching{ 0 }; // Workers out of local work and looking elsewhere
+    PostQueue* postQueue = nullptr;
+    std::array<PlatformManager*, PLATFORM_COUNT> platformManagers{}; // By platformIndex, no hashing per post
+    std::vector<size_t> homeLanes;
+    std::unique_ptr<TimerService> timers; // Wakes suspended posts, only made for a pool with posts
+    std::atomic<size_t> postsInFlight{ 0 };
+    std::atomic<bool> stop{ false };
+
+    std::thread monitorThread;
+    std::mutex monitorMutex;
+    std::condition_variable monitorCV;
+    std::atomic<int64_t> worstLatency{ 0 }; // Nanoseconds, longest sampled wait since the monitor last looked
+
+    static constexpr size_t MAX_POSTS_IN_FLIGHT = 10000;
+    static constexpr uint32_t LATENCY_SAMPLE = 64; // One submitted job in this many is timed
+
+    // Which pool and worker the current thread belongs to, if any
+    static inline thread_local ThreadPool* currentPool = nullptr;
+    static inline thread_local size_t currentIndex = 0;
 
 public:
+    // A general pool, for execute() only, with a fixed number of workers
+    explicit ThreadPool(size_t numThreads)
+        : ThreadPool(Sizing{ numThreads, numThreads }) {}
+
+    // A general pool that sizes itself
+    explicit ThreadPool(const Sizing& sizing)
+    {
+        start(sizing);
+    }
+
+    // A pool that also works through the post queue
     ThreadPool(size_t numThreads, PostQueue& queue, std::unordered_map<Platform, PlatformManager*>& managers)
-        : postQueue(queue),
-        platformManagers(managers)
+        : ThreadPool(Sizing{ numThreads, numThreads }, queue, managers) {}
+
+    ThreadPool(const Sizing& sizing, PostQueue& queue, std::unordered_map<Platform, PlatformManager*>& managers)
+        : postQueue(&queue),
+        timers(std::make_unique<TimerService>())
     {
-        for (size_t i = 0; i < numThreads; i++)
+        for (auto& entry : managers)
         {
-            workers.emplace_back([this, i]() {
-                workerFunction();
-                });
+            platformManagers[platformIndex(entry.first)] = entry.second;
+            entry.second->attach(*this, *timers);
         }
+        for (size_t i = 0; i < std::max<size_t>(sizing.maxThreads, 1); i++)
+        {
+            homeLanes.push_back(postQueue->homeLane(i));
+        }
+        postQueue->wakeOnPost(&idle);
+        start(sizing);
     }
+
     ~ThreadPool()
     {
-        for (auto& a : workers) a.join();
+        // The queue's timers wake `idle` from their own thread, so unhook it before anything here goes away.
+        // Draining doesn't need them: once shut down every lane is due, and workers look again whenever a post finishes.
+        if (postQueue) postQueue->wakeOnPost(nullptr);
+        shutdown();
+        if (monitorThread.joinable()) monitorThread.join();
+        for (auto& worker : workers)
+        {
+            if (worker->thread.joinable()) worker->thread.join();
+        }
     }
+
+    // Workers finish everything already submitted (and the remaining posts, including suspended ones) before they exit
     void shutdown()
     {
         stop.store(true);
-        postQueue.shutdown();
+        if (postQueue) postQueue->shutdown();
+        idle.notifyAll();
+        {
+            std::lock_guard<std::mutex> lock(monitorMutex);
+        }
+        monitorCV.notify_all();
+    }
+
+    // Run work on the pool. From a worker it goes on that worker's own deque.
+    void execute(Task work) override
+    {
+        enqueue(std::move(work));
+
+        // A worker that is already looking for work will find this, only wake one if nobody is
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (searching.load(std::memory_order_relaxed) == 0)
+        {
+            idle.notifyOne();
+        }
+    }
+
+    // Queue many tasks, waking the workers once at the end
+    void executeBulk(std::vector<Task>& work)
+    {
+        for (Task& task : work)
+        {
+            enqueue(std::move(task));
+        }
+        work.clear();
+        idle.notifyAll();
+    }
+
+    // Run f(args...) on the pool, the future gets its result or exception
+    template <typename F, typename... Args>
+    auto submit(F&& f, Args&&... args) -> std::future<std::invoke_result_t<std::decay_t<F>, std::decay_t<Args>...>>
+    {
+        typedef std::invoke_result_t<std::decay_t<F>, std::decay_t<Args>...> Result;
+
+        std::promise<Result> promise;
+        std::future<Result> future = promise.get_future();
+        execute([promise = std::move(promise), f = std::forward<F>(f),
+            arguments = std::make_tuple(std::forward<Args>(args)...)]() mutable {
+            try
+            {
+                if constexpr (std::is_void_v<Result>)
+                {
+                    std::apply(f, std::move(arguments));
+                    promise.set_value();
+                }
+                else
+                {
+                    promise.set_value(std::apply(f, std::move(arguments)));
+                }
+            }
+            catch (...)
+            {
+                promise.set_exception(std::current_exception());
+            }
+            });
+        return future;
+    }
+
+    // Call body(i) for every i in [begin, end), in chunks of `grain` (0 picks one)
+    // The caller takes chunks too, and a worker calling this keeps running other work while it waits
+    template <typename Index, typename Body>
+    void parallelFor(Index begin, Index end, Body&& body, Index grain = 0)
+    {
+        if (end <= begin) return;
+        size_t count = (size_t)(end - begin);
+        size_t chunk = grain > 0 ? (size_t)grain : std::max<size_t>(1, count / (size() * 4));
+        size_t chunks = (count + chunk - 1) / chunk;
+
+        struct Loop
+        {
+            std::atomic<size_t> next{ 0 };
+            std::atomic<size_t> finished{ 0 };
+            std::atomic<bool> done{ false };
+        };
+        auto loop = std::make_shared<Loop>();
+        std::remove_reference_t<Body>* function = &body;
+
+        // Helpers only touch `function` after claiming a chunk, so late starters never see a dead frame
+        auto work = [loop, function, begin, end, chunk, chunks]() {
+            size_t i;
+            while ((i = loop->next.fetch_add(1)) < chunks)
+            {
+                Index first = begin + (Index)(i * chunk);
+                Index last = std::min<Index>(end, first + (Index)chunk);
+                for (Index index = first; index < last; ++index)
+                {
+                    (*function)(index);
+                }
+                if (loop->finished.fetch_add(1) + 1 == chunks)
+                {
+                    loop->done.store(true);
+                    loop->done.notify_all();
+                }
+            }
+        };
+
+        size_t helpers = std::min(chunks - 1, size());
+        for (size_t i = 0; i < helpers; i++)
+        {
+            execute(work);
+        }
+        work();
+
+        if (currentPool == this)
+        {
+            std::minstd_rand random((unsigned)currentIndex + 1);
+            while (!loop->done.load())
+            {
+                if (!runOne(currentIndex, random, false)) std::this_thread::yield();
+            }
+        }
+        else
+        {
+            loop->done.wait(false);
+        }
+    }
+
+    // Workers running right now
+    size_t size() const
+    {
+        return liveWorkers.load();
     }
 
 private:
-    void workerFunction()
+    bool isAdaptive() const
+    {
+        return sizing.minThreads < sizing.maxThreads;
+    }
+
+    static int64_t nowNanoseconds()
     {
-        while (!postQueue.isEmpty())
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    void enqueue(Task&& work)
+    {
+        Job* job = TaskNodePool::acquire(std::move(work));
+        job->enqueuedAt = 0;
+        if (currentPool == this)
+        {
+            workers[currentIndex]->jobs.push(job);
+        }
+        else
+        {
+            thread_local uint32_t submitted = 0;
+            if (isAdaptive() && ++submitted % LATENCY_SAMPLE == 0)
+            {
+                job->enqueuedAt = nowNanoseconds();
+            }
+            injected.push(job);
+        }
+    }
+
+    void start(const Sizing& requested)
+    {
+        sizing = requested;
+        sizing.minThreads = std::max<size_t>(sizing.minThreads, 1);
+        sizing.maxThreads = std::max(sizing.maxThreads, sizing.minThreads);
+
+        for (size_t i = 0; i < sizing.maxThreads; i++)
+        {
+            workers.push_back(std::make_unique<Worker>());
+        }
+        grow(sizing.minThreads);
+
+        if (isAdaptive())
+        {
+            monitorThread = std::thread([this]() {
+                monitorFunction();
+                });
+        }
+    }
+
+    // Start up to `count` workers in free slots. Only called by the constructor and then the monitor.
+    void grow(size_t count)
+    {
+        for (size_t i = 0; i < workers.size() && count > 0; i++)
+        {
+            Worker& worker = *workers[i];
+            if (worker.running.load(std::memory_order_acquire)) continue;
+
+            if (worker.thread.joinable()) worker.thread.join(); // The worker that had this slot has retired
+            worker.running.store(true);
+            worker.parked.store(false);
+            worker.lastProgress = worker.progress.load();
+            liveWorkers.fetch_add(1);
+            worker.thread = std::thread([this, i]() {
+                workerFunction(i);
+                });
+            count--;
+        }
+    }
+
+    // A worker that found nothing to do for idleTimeout leaves, unless that would go below the minimum
+    bool retire(size_t index)
+    {
+        size_t live = liveWorkers.load();
+        while (live > sizing.minThreads)
         {
-            std::shared_ptr<Post> nextPost = postQueue.getNextPost();
-            platformManagers[nextPost->getPlatform()]->processPost(nextPost);
+            if (liveWorkers.compare_exchange_weak(live, live - 1))
+            {
+                workers[index]->running.store(false, std::memory_order_release);
+                return true;
+            }
         }
+        return false;
+    }
+
+    void monitorFunction()
+    {
+        std::unique_lock<std::mutex> lock(monitorMutex);
+        while (!monitorCV.wait_for(lock, sizing.sampleInterval, [this] { return stop.load(); }))
+        {
+            adjust();
+        }
+    }
+
+    // Add workers when work is queued, nobody is idle, and either workers are blocked or work waits too long
+    void adjust()
+    {
+        size_t live = 0;
+        size_t parked = 0;
+        size_t blocked = 0;
+        size_t depth = injected.sizeApprox();
+        for (auto& slot : workers)
+        {
+            Worker& worker = *slot;
+            depth += worker.jobs.sizeApprox();
+            if (!worker.running.load(std::memory_order_acquire)) continue;
+
+            live++;
+            uint64_t progress = worker.progress.load(std::memory_order_relaxed);
+            if (worker.parked.load(std::memory_order_relaxed))
+            {
+                parked++;
+            }
+            else if (progress == worker.lastProgress)
+            {
+                blocked++; // Inside the same job for a whole interval
+            }
+            worker.lastProgress = progress;
+        }
+        if (postQueue && !postQueue->isEmpty()) depth++;
+
+        std::chrono::nanoseconds latency(worstLatency.exchange(0));
+        if (depth == 0 || parked > 0 || live >= sizing.maxThreads) return;
+
+        // Blocked workers aren't using a core, so replace them. Extra workers only help slow queues up to the core count.
+        size_t wanted = 0;
+        if (blocked > 0) wanted = blocked;
+        else if (latency > sizing.targetLatency && live < std::max(1u, std::thread::hardware_concurrency())) wanted = 1;
+        grow(std::min(wanted, sizing.maxThreads - live));
+    }
+
+    // Runs until shutdown, then drains what is left
+    void workerFunction(size_t index)
+    {
+        currentPool = this;
+        currentIndex = index;
+        std::minstd_rand random((unsigned)index + 1);
+
+        Worker& self = *workers[index];
+
+        while (true)
+        {
+            if (runOne(index, random))
+            {
+                self.progress.fetch_add(1, std::memory_order_relaxed);
+                continue;
+            }
+
+            searching.fetch_sub(1);
+            uint32_t key = idle.prepareWait();
+            if (runOne(index, random, false)) // Last look, as a sleeper, so a submit can't slip past
+            {
+                idle.cancelWait();
+                self.progress.fetch_add(1, std::memory_order_relaxed);
+                continue;
+            }
+            if (stop.load() && postsInFlight.load() == 0)
+            {
+                idle.cancelWait();
+                return;
+            }
+
+            self.parked.store(true, std::memory_order_relaxed);
+            bool woken = true;
+            if (isAdaptive() && liveWorkers.load() > sizing.minThreads)
+            {
+                woken = idle.waitUntil(key, std::chrono::steady_clock::now() + sizing.idleTimeout);
+            }
+            else
+            {
+                idle.wait(key);
+            }
+            self.parked.store(false, std::memory_order_relaxed);
+
+            // Timed out. Work that raced with the timeout is still found by runOne; the deque is empty here.
+            if (!woken && !stop.load() && !runOne(index, random, false) && retire(index))
+            {
+                return;
+            }
+        }
+    }
+
+    // When `search` is set and nothing is found, returns with `searching` raised and
+    // the caller lowers it again before parking
+    bool runOne(size_t index, std::minstd_rand& random, bool search = true)
+    {
+        Job* job = nullptr;
+        if (workers[index]->jobs.pop(job))
+        {
+            run(job);
+            return true;
+        }
+
+        if (search) searching.fetch_add(1);
+        if (injected.tryPop(job) || steal(index, random, job))
+        {
+            if (search) searching.fetch_sub(1);
+            run(job);
+            return true;
+        }
+
+        if (postQueue && postsInFlight.load(std::memory_order_relaxed) < MAX_POSTS_IN_FLIGHT)
+        {
+            std::vector<std::shared_ptr<Post>>& batch = workers[index]->batch;
+            if (postQueue->tryGetNextBatch(homeLanes[index], batch))
+            {
+                if (search) searching.fetch_sub(1);
+                startPosts(batch);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Runs the posts until they first suspend, a timer hands them back to the pool to finish
+    // Leaves `batch` empty
+    void startPosts(std::vector<std::shared_ptr<Post>>& batch)
+    {
+        size_t count = batch.size();
+        postsInFlight.fetch_add(count);
+        Platform platform = batch.front()->getPlatform();
+        PlatformManager* manager = platformManagers[platformIndex(platform)];
+
+        AsyncTask work = count == 1 ? publishPost(manager, std::move(batch.front())) : publishBatch(manager, std::move(batch));
+        batch.clear();
+        spawn(std::move(work), [this, platform, count]() {
+            postQueue->finishPost(platform);
+            if (postsInFlight.fetch_sub(count) == count && stop.load())
+            {
+                idle.notifyAll(); // Parked workers may be waiting for the last post to exit
+            }
+            });
+    }
+
+    AsyncTask publishPost(PlatformManager* manager, std::shared_ptr<Post> post)
+    {
+        co_await manager->processPost(post);
+        postQueue->completePost(std::move(post));
+    }
+
+    AsyncTask publishBatch(PlatformManager* manager, std::vector<std::shared_ptr<Post>> batch)
+    {
+        co_await manager->processBatch(batch);
+        for (auto& post : batch)
+        {
+            postQueue->completePost(std::move(post));
+        }
+    }
+
+    void run(Job* job)
+    {
+        if (job->enqueuedAt != 0)
+        {
+            int64_t waited = nowNanoseconds() - job->enqueuedAt;
+            int64_t worst = worstLatency.load(std::memory_order_relaxed);
+            while (waited > worst && !worstLatency.compare_exchange_weak(worst, waited, std::memory_order_relaxed)) {}
+        }
+        job->task();
+        TaskNodePool::release(job);
+    }
+
+    // Try every other worker once, starting from a random one
+    bool steal(size_t index, std::minstd_rand& random, Job*& job)
+    {
+        size_t count = workers.size();
+        size_t first = random() % count;
+        for (size_t i = 0; i < count; i++)
+        {
+            size_t victim = (first + i) % count;
+            if (victim != index && !workers[victim]->jobs.isEmpty() && workers[victim]->jobs.steal(job))
+            {
+                return true;
+            }
+        }
+        return false;
     }
 };
 
@@ -234,41 +1808,73 @@ public:
         // Create post queue
         PostQueue queue;
 
+        // Tweets go out in batches of up to 3, or whatever has waited 100ms
+        queue.configureBatching(Platform::TWITTER, 3, std::chrono::milliseconds(100));
+
+        // LinkedIn takes at most 2 posts a second
+        queue.configureRateLimit(Platform::LINKEDIN, 2.0, 2);
+
+        // Urgent posts go ahead of everything else waiting on their platform
+        queue.configurePriorities(PriorityMode::STRICT);
+
         // Create some sample posts
-        queue.addPost(std::make_shared<Post>("Hello Facebook!", Platform::FACEBOOK));
-        queue.addPost(std::make_shared<Post>("Another Facebook post", Platform::FACEBOOK));
-        queue.addPost(std::make_shared<Post>("Yet another Facebook post", Platform::FACEBOOK));
+        queue.addPost(Post::create("Hello Facebook!", Platform::FACEBOOK));
+        queue.addPost(Post::create("Another Facebook post", Platform::FACEBOOK));
+        queue.addPost(Post::create("Yet another Facebook post", Platform::FACEBOOK));
 
-        queue.addPost(std::make_shared<Post>("Tweet tweet!", Platform::TWITTER));
-        queue.addPost(std::make_shared<Post>("Another tweet", Platform::TWITTER));
-        queue.addPost(std::make_shared<Post>("Yet another tweet", Platform::TWITTER));
+        queue.addPost(Post::create("Tweet tweet!", Platform::TWITTER));
+        queue.addPost(Post::create("Another tweet", Platform::TWITTER));
+        queue.addPost(Post::create("Yet another tweet", Platform::TWITTER));
 
-        queue.addPost(std::make_shared<Post>("Instagram photo time!", Platform::INSTAGRAM));
-        queue.addPost(std::make_shared<Post>("Another Instagram post", Platform::INSTAGRAM));
-        queue.addPost(std::make_shared<Post>("Yet another Instagram post", Platform::INSTAGRAM));
+        queue.addPost(Post::create("Instagram photo time!", Platform::INSTAGRAM));
+        queue.addPost(Post::create("Another Instagram post", Platform::INSTAGRAM));
+        queue.addPost(Post::create("Yet another Instagram post", Platform::INSTAGRAM));
 
-        queue.addPost(std::make_shared<Post>("LinkedIn post", Platform::LINKEDIN));
-        queue.addPost(std::make_shared<Post>("Another LinkedIn post", Platform::LINKEDIN));
-        queue.addPost(std::make_shared<Post>("Yet another LinkedIn post", Platform::LINKEDIN));
+        queue.addPost(Post::create("LinkedIn post", Platform::LINKEDIN));
+        queue.addPost(Post::create("Another LinkedIn post", Platform::LINKEDIN));
+        queue.addPost(Post::create("Yet another LinkedIn post", Platform::LINKEDIN));
 
-        queue.addPost(std::make_shared<Post>("Snapchat story", Platform::SNAPCHAT));
-        queue.addPost(std::make_shared<Post>("Another Snapchat story", Platform::SNAPCHAT));
-        queue.addPost(std::make_shared<Post>("Yet another Snapchat story", Platform::SNAPCHAT));
+        queue.addPost(Post::create("Snapchat story", Platform::SNAPCHAT));
+        queue.addPost(Post::create("Another Snapchat story", Platform::SNAPCHAT));
+        queue.addPost(Post::create("Yet another Snapchat story", Platform::SNAPCHAT));
 
-        queue.addPost(std::make_shared<Post>("StackOverflow question", Platform::STACKOVERFLOW));
-        queue.addPost(std::make_shared<Post>("Another StackOverflow question", Platform::STACKOVERFLOW));
-        queue.addPost(std::make_shared<Post>("Yet another StackOverflow question", Platform::STACKOVERFLOW));
+        queue.addPost(Post::create("StackOverflow question", Platform::STACKOVERFLOW));
+        queue.addPost(Post::create("Another StackOverflow question", Platform::STACKOVERFLOW));
+        queue.addPost(Post::create("Yet another StackOverflow question", Platform::STACKOVERFLOW));
 
-        // Create ThreadPool
-        size_t numThreads = std::thread::hardware_concurrency();
-        if (numThreads == 0) numThreads = 4; // Default to 4 if unable to detect
-        ThreadPool pool(numThreads, queue, platformManagers);
+        queue.addPost(Post::create("Urgent Facebook update", Platform::FACEBOOK, {}, Priority::HIGH));
 
-        // Wait for some time
-        std::this_thread::sleep_for(std::chrono::seconds(2));
+        // A cross-post is one post per platform sharing one copy of the text
+        for (auto& post : Post::createCrossPost("Cross-posted announcement", { Platform::FACEBOOK, Platform::INSTAGRAM, Platform::LINKEDIN }))
+        {
+            queue.addPost(std::move(post));
+        }
+
+        // Scheduled posts are held back until their publish time
+        auto publishAt = std::chrono::steady_clock::now() + std::chrono::milliseconds(500);
+        queue.addPost(Post::create("Scheduled Facebook post", Platform::FACEBOOK, publishAt));
+        auto cancelled = Post::create("Cancelled tweet", Platform::TWITTER, publishAt);
+        queue.addPost(cancelled);
+        queue.cancelPost(cancelled);
+
+        // Create ThreadPool, from 1 worker up to 4 per hardware thread depending on the load
+        size_t hardwareThreads = std::thread::hardware_concurrency();
+        if (hardwareThreads == 0) hardwareThreads = 4; // Default to 4 if unable to detect
+        ThreadPool::Sizing sizing;
+        sizing.minThreads = 1;
+        sizing.maxThreads = hardwareThreads * 4;
+        {
+            ThreadPool pool(sizing, queue, platformManagers);
+
+            // Wait for some time
+            std::this_thread::sleep_for(std::chrono::seconds(2));
+
+            // Shutdown the queue and the thread pool
+            pool.shutdown();
+            // The pool destructor will join the threads
+        }
 
-        // Shutdown the queue and the thread pool
-        pool.shutdown();
-        // The pool destructor will join the threads
+        // How long posts waited and took, per platform
+        std::cout << queue.metricsReport();
     }
 };
@@ -0,0 +1,158 @@
+#pragma once
+
+#include <coroutine>
+#include <exception>
+#include <iostream>
+#include <syncstream>
+#include <chrono>
+#include <utility>
+
+#include "Task.cpp"
+#include "TimerService.cpp"
+
+// A coroutine that returns nothing and can be awaited
+/*
+* -Lazy: the body only starts when it is awaited or spawned
+* -When it finishes it continues straight into whoever awaited it
+* -Exceptions are handed to the awaiter
+*/
+class AsyncTask
+{
+public:
+    struct promise_type
+    {
+        std::coroutine_handle<> continuation;
+        std::exception_ptr error;
+
+        AsyncTask get_return_object()
+        {
+            return AsyncTask(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+
+        std::suspend_always initial_suspend() noexcept { return {}; }
+
+        struct FinalAwaiter
+        {
+            bool await_ready() noexcept { return false; }
+
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle) noexcept
+            {
+                std::coroutine_handle<> next = handle.promise().continuation;
+                return next ? next : std::noop_coroutine();
+            }
+
+            void await_resume() noexcept {}
+        };
+
+        FinalAwaiter final_suspend() noexcept { return {}; }
+
+        void return_void() {}
+
+        void unhandled_exception()
+        {
+            error = std::current_exception();
+        }
+    };
+
+    AsyncTask(AsyncTask&& other) noexcept
+        : handle(std::exchange(other.handle, nullptr)) {}
+
+    AsyncTask(const AsyncTask&) = delete;
+    AsyncTask& operator=(const AsyncTask&) = delete;
+
+    ~AsyncTask()
+    {
+        if (handle) handle.destroy();
+    }
+
+    bool await_ready() const
+    {
+        return !handle || handle.done();
+    }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting)
+    {
+        handle.promise().continuation = awaiting;
+        return handle;
+    }
+
+    void await_resume()
+    {
+        if (handle.promise().error) std::rethrow_exception(handle.promise().error);
+    }
+
+private:
+    std::coroutine_handle<promise_type> handle;
+
+    explicit AsyncTask(std::coroutine_handle<promise_type> handle)
+        : handle(handle) {}
+};
+
+// Coroutine that starts straight away and frees itself when done, used by spawn()
+struct DetachedTask
+{
+    struct promise_type
+    {
+        DetachedTask get_return_object() noexcept { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept { std::terminate(); }
+    };
+};
+
+// Start a task without waiting for it. It runs on the calling thread until it first suspends.
+// onDone runs when it has finished, however it finished.
+inline DetachedTask spawn(AsyncTask task, Task onDone)
+{
+    try
+    {
+        co_await task;
+    }
+    catch (const std::exception& e)
+    {
+        std::osyncstream(std::cerr) << "Async task failed: " << e.what() << std::endl;
+    }
+    onDone();
+}
+
+// Suspends the coroutine and hands `start` a callback. Calling the callback (from any thread, once)
+// continues the coroutine on `executor`. Timers and I/O completions plug in this way.
+template <typename Start>
+class CompletionAwaiter
+{
+public:
+    CompletionAwaiter(Executor& executor, Start start)
+        : executor(executor), start(std::move(start)) {}
+
+    bool await_ready() const { return false; }
+
+    void await_suspend(std::coroutine_handle<> handle)
+    {
+        Executor* target = &executor;
+        start(Task([target, handle]() {
+            target->execute([handle]() { handle.resume(); });
+            }));
+    }
+
+    void await_resume() {}
+
+private:
+    Executor& executor;
+    Start start;
+};
+
+template <typename Start>
+CompletionAwaiter<Start> whenComplete(Executor& executor, Start start)
+{
+    return CompletionAwaiter<Start>(executor, std::move(start));
+}
+
+// co_await sleepFor(...) suspends without holding a thread, then continues on `executor`
+inline auto sleepFor(Executor& executor, TimerService& timers, std::chrono::steady_clock::duration delay)
+{
+    auto deadline = TimerService::Clock::now() + delay;
+    return whenComplete(executor, [&timers, deadline](Task resume) {
+        timers.schedule(deadline, std::move(resume));
+        });
+}
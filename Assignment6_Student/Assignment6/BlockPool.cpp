@@ -0,0 +1,162 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <mutex>
+#include <vector>
+#include <memory>
+#include <algorithm>
+
+// Fixed-size block allocator
+/*
+* -Blocks are carved out of 64 KB chunks, so they carry no per-allocation malloc header
+* -Each thread keeps a cache of free blocks and swaps them with a shared free list in batches,
+*  so the shared lock is taken once per BATCH allocations, not once per allocation
+* -Memory goes back to the pool, never to the system, so a pool only grows to its peak
+*/
+template <size_t BlockSize>
+class BlockPool
+{
+public:
+    static constexpr size_t SIZE = (BlockSize + alignof(std::max_align_t) - 1) / alignof(std::max_align_t) * alignof(std::max_align_t);
+
+    static void* allocate()
+    {
+        std::vector<void*>& cache = localCache().blocks;
+        if (cache.empty()) refill(cache);
+        void* block = cache.back();
+        cache.pop_back();
+        return block;
+    }
+
+    static void deallocate(void* block)
+    {
+        std::vector<void*>& cache = localCache().blocks;
+        if (cache.size() >= LOCAL_LIMIT) // Hand half back, so a thread that only frees doesn't hoard
+        {
+            Shared& pool = shared();
+            std::lock_guard<std::mutex> lock(pool.poolMutex);
+            pool.freeBlocks.insert(pool.freeBlocks.end(), cache.end() - BATCH, cache.end());
+            cache.resize(cache.size() - BATCH);
+        }
+        cache.push_back(block);
+    }
+
+private:
+    static constexpr size_t CHUNK_BYTES = 64 * 1024;
+    static constexpr size_t BLOCKS_PER_CHUNK = CHUNK_BYTES / SIZE > 0 ? CHUNK_BYTES / SIZE : 1;
+    static constexpr size_t BATCH = 64;
+    static constexpr size_t LOCAL_LIMIT = BATCH * 2;
+
+    struct Shared
+    {
+        std::mutex poolMutex;
+        std::vector<void*> freeBlocks;
+        std::vector<std::unique_ptr<std::byte[]>> chunks;
+    };
+
+    struct LocalCache
+    {
+        std::vector<void*> blocks;
+
+        ~LocalCache() // Hand the blocks on when the thread exits
+        {
+            Shared& pool = shared();
+            std::lock_guard<std::mutex> lock(pool.poolMutex);
+            pool.freeBlocks.insert(pool.freeBlocks.end(), blocks.begin(), blocks.end());
+        }
+    };
+
+    static Shared& shared()
+    {
+        static Shared pool;
+        return pool;
+    }
+
+    static LocalCache& localCache()
+    {
+        thread_local LocalCache cache;
+        return cache;
+    }
+
+    static void refill(std::vector<void*>& cache)
+    {
+        Shared& pool = shared();
+        std::lock_guard<std::mutex> lock(pool.poolMutex);
+        if (!pool.freeBlocks.empty())
+        {
+            size_t count = std::min(BATCH, pool.freeBlocks.size());
+            cache.insert(cache.end(), pool.freeBlocks.end() - count, pool.freeBlocks.end());
+            pool.freeBlocks.resize(pool.freeBlocks.size() - count);
+            return;
+        }
+
+        // new[] of std::byte is aligned for any fundamental type, and SIZE keeps every block that way
+        pool.chunks.emplace_back(new std::byte[BLOCKS_PER_CHUNK * SIZE]);
+        std::byte* chunk = pool.chunks.back().get();
+        for (size_t i = BLOCKS_PER_CHUNK; i > 0; i--)
+        {
+            cache.push_back(chunk + (i - 1) * SIZE);
+        }
+    }
+};
+
+// Standard allocator on top of BlockPool, for std::allocate_shared and node containers
+template <typename T>
+class PoolAllocator
+{
+    static_assert(alignof(T) <= alignof(std::max_align_t), "BlockPool only guarantees fundamental alignment");
+
+public:
+    typedef T value_type;
+
+    PoolAllocator() = default;
+
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U>&) {}
+
+    T* allocate(size_t count)
+    {
+        if (count == 1) return static_cast<T*>(BlockPool<sizeof(T)>::allocate());
+        return std::allocator<T>().allocate(count);
+    }
+
+    void deallocate(T* pointer, size_t count)
+    {
+        if (count == 1) BlockPool<sizeof(T)>::deallocate(pointer);
+        else std::allocator<T>().deallocate(pointer, count);
+    }
+
+    template <typename U>
+    bool operator==(const PoolAllocator<U>&) const { return true; }
+
+    template <typename U>
+    bool operator!=(const PoolAllocator<U>&) const { return false; }
+};
+
+// Variable-size byte buffers from BlockPools of 16 to 256 bytes, bigger ones from the heap
+class BytePool
+{
+public:
+    static char* allocate(size_t size)
+    {
+        if (size <= 16) return static_cast<char*>(BlockPool<16>::allocate());
+        if (size <= 32) return static_cast<char*>(BlockPool<32>::allocate());
+        if (size <= 64) return static_cast<char*>(BlockPool<64>::allocate());
+        if (size <= 128) return static_cast<char*>(BlockPool<128>::allocate());
+        if (size <= 256) return static_cast<char*>(BlockPool<256>::allocate());
+        return new char[size];
+    }
+
+    // `size` must be the size it was allocated with
+    static void deallocate(char* bytes, size_t size)
+    {
+        if (size <= 16) BlockPool<16>::deallocate(bytes);
+        else if (size <= 32) BlockPool<32>::deallocate(bytes);
+        else if (size <= 64) BlockPool<64>::deallocate(bytes);
+        else if (size <= 128) BlockPool<128>::deallocate(bytes);
+        else if (size <= 256) BlockPool<256>::deallocate(bytes);
+        else delete[] bytes;
+    }
+};
@@ -0,0 +1,166 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <string_view>
+#include <cstdint>
+#include <cstring>
+#include <bit>
+#include <algorithm>
+
+// Remembers 64-bit keys for a time window, to turn away repeats
+/*
+* -Sharded by the key's top bits, each shard an open-addressing table behind its own lock,
+*  so inserts from different threads rarely meet and each one is a short probe
+* -An entry expires `window` after it was first inserted; expired entries are skipped and reused,
+*  and dropped for good when a shard fills up and rebuilds itself
+* -Keys should already be well mixed, e.g. from hash()
+*/
+class DuplicateFilter
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    explicit DuplicateFilter(Clock::duration window, size_t shardCount = 64)
+        : window(std::chrono::duration_cast<std::chrono::nanoseconds>(window).count()),
+        shardBits(std::bit_width(std::bit_ceil(std::max<size_t>(shardCount, 1))) - 1),
+        shards(std::make_unique<Shard[]>((size_t)1 << shardBits)) {}
+
+    DuplicateFilter(const DuplicateFilter&) = delete;
+    DuplicateFilter& operator=(const DuplicateFilter&) = delete;
+
+    // True the first time `key` is seen in the window, false for a repeat
+    bool insert(uint64_t key, Clock::time_point now = Clock::now())
+    {
+        if (key == EMPTY) key = 1;
+        int64_t time = std::chrono::duration_cast<std::chrono::nanoseconds>(now.time_since_epoch()).count();
+        Shard& shard = shards[shardBits == 0 ? 0 : key >> (64 - shardBits)];
+
+        std::lock_guard<std::mutex> lock(shard.shardMutex);
+        if ((shard.used + 1) * 2 > shard.slots.size())
+        {
+            rebuild(shard, time);
+        }
+
+        size_t mask = shard.slots.size() - 1;
+        size_t reusable = SIZE_MAX;
+        for (size_t i = key & mask;; i = (i + 1) & mask)
+        {
+            Entry& entry = shard.slots[i];
+            if (entry.key == EMPTY)
+            {
+                if (reusable == SIZE_MAX)
+                {
+                    reusable = i;
+                    shard.used++;
+                }
+                break;
+            }
+            if (entry.key == key)
+            {
+                if (entry.expires > time) return false;
+                entry.expires = time + window;
+                return true;
+            }
+            if (entry.expires <= time && reusable == SIZE_MAX)
+            {
+                reusable = i;
+            }
+        }
+
+        shard.slots[reusable] = { key, time + window };
+        return true;
+    }
+
+    // Keys held, including expired ones not yet dropped
+    size_t size()
+    {
+        size_t total = 0;
+        for (size_t i = 0; i < ((size_t)1 << shardBits); i++)
+        {
+            std::lock_guard<std::mutex> lock(shards[i].shardMutex);
+            total += shards[i].used;
+        }
+        return total;
+    }
+
+    // Fast 64-bit hash, 8 bytes at a time (not for use against adversaries)
+    static uint64_t hash(std::string_view bytes, uint64_t seed = 0)
+    {
+        const uint64_t K = 0x9E3779B97F4A7C15ull;
+        uint64_t h = mix(seed ^ (bytes.size() * K));
+        const char* data = bytes.data();
+        size_t size = bytes.size();
+        while (size >= 8)
+        {
+            uint64_t word;
+            std::memcpy(&word, data, 8);
+            h = (h ^ mix(word)) * K;
+            data += 8;
+            size -= 8;
+        }
+        if (size > 0)
+        {
+            uint64_t word = 0;
+            std::memcpy(&word, data, size);
+            h = (h ^ mix(word)) * K;
+        }
+        return mix(h);
+    }
+
+private:
+    static constexpr uint64_t EMPTY = 0;
+    static constexpr size_t MIN_SLOTS = 16;
+
+    struct Entry
+    {
+        uint64_t key = EMPTY;
+        int64_t expires = 0; // Steady clock nanoseconds
+    };
+
+    struct alignas(64) Shard
+    {
+        std::mutex shardMutex;
+        std::vector<Entry> slots;
+        size_t used = 0; // Slots that are not EMPTY, expired or not
+    };
+
+    const int64_t window;
+    const int shardBits;
+    std::unique_ptr<Shard[]> shards;
+
+    static uint64_t mix(uint64_t x)
+    {
+        x ^= x >> 33;
+        x *= 0xFF51AFD7ED558CCDull;
+        x ^= x >> 33;
+        x *= 0xC4CEB9FE1A85EC53ull;
+        x ^= x >> 33;
+        return x;
+    }
+
+    // Drop expired entries, and grow if what is left would still be half full
+    void rebuild(Shard& shard, int64_t time)
+    {
+        size_t live = 0;
+        for (const Entry& entry : shard.slots)
+        {
+            if (entry.key != EMPTY && entry.expires > time) live++;
+        }
+
+        std::vector<Entry> old = std::move(shard.slots);
+        shard.slots.assign(std::max(MIN_SLOTS, std::bit_ceil((live + 1) * 4)), Entry());
+        shard.used = 0;
+        size_t mask = shard.slots.size() - 1;
+        for (const Entry& entry : old)
+        {
+            if (entry.key == EMPTY || entry.expires <= time) continue;
+            size_t i = entry.key & mask;
+            while (shard.slots[i].key != EMPTY) i = (i + 1) & mask;
+            shard.slots[i] = entry;
+            shard.used++;
+        }
+    }
+};
@@ -0,0 +1,195 @@
+#pragma once
+
+#include <vector>
+#include <array>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <cstddef>
+
+// Latency histograms and counters, sharded per thread
+/*
+* -Values are kept per group (e.g. a platform) and stage (e.g. time queued), counters per group
+* -Every recording thread writes only its own shard with plain relaxed stores, so recording never
+*  contends; reading adds the shards up
+* -Histograms are log-linear over microseconds: 8 buckets per power of two, so a percentile is within
+*  about 6% of the true value, from 1 us up to about 19 hours
+*/
+class LatencyMetrics
+{
+public:
+    static constexpr size_t SUB_BUCKETS = 8;
+    static constexpr size_t MAX_OCTAVE = 36; // Values are capped at 2^36 us
+    static constexpr size_t BUCKETS = SUB_BUCKETS + (MAX_OCTAVE - 3) * SUB_BUCKETS;
+
+    // A merged histogram, for reading
+    struct Histogram
+    {
+        std::array<uint64_t, BUCKETS> counts{};
+        uint64_t total = 0;
+        int64_t maxNanoseconds = 0;
+
+        // Milliseconds, at the middle of the bucket the percentile falls in
+        double percentile(double p) const
+        {
+            if (total == 0) return 0.0;
+            uint64_t rank = std::max<uint64_t>(1, (uint64_t)(p * total + 0.5));
+            uint64_t seen = 0;
+            for (size_t i = 0; i < BUCKETS; i++)
+            {
+                seen += counts[i];
+                if (seen >= rank)
+                {
+                    double middle = bucketLow(i) + bucketWidth(i) / 2.0;
+                    return std::min(middle, maxNanoseconds / 1000.0) / 1000.0;
+                }
+            }
+            return maxNanoseconds / 1e6;
+        }
+    };
+
+    LatencyMetrics(size_t groups, size_t stages, size_t counters)
+        : groups(groups), stages(stages), counters(counters),
+        id(nextId.fetch_add(1, std::memory_order_relaxed)) {}
+
+    LatencyMetrics(const LatencyMetrics&) = delete;
+    LatencyMetrics& operator=(const LatencyMetrics&) = delete;
+
+    // Steady clock nanoseconds, the time base for everything recorded here
+    static int64_t now()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    void record(size_t group, size_t stage, int64_t nanoseconds)
+    {
+        if (nanoseconds < 0) nanoseconds = 0;
+        std::atomic<uint64_t>* cells = localShard().cells.get() + histogramOffset(group, stage);
+        bump(cells[bucketOf((uint64_t)nanoseconds / 1000)]);
+        std::atomic<uint64_t>& max = cells[BUCKETS];
+        if ((uint64_t)nanoseconds > max.load(std::memory_order_relaxed))
+        {
+            max.store((uint64_t)nanoseconds, std::memory_order_relaxed);
+        }
+    }
+
+    void count(size_t group, size_t counter, uint64_t amount = 1)
+    {
+        bump(localShard().cells[counterOffset(group, counter)], amount);
+    }
+
+    Histogram histogram(size_t group, size_t stage)
+    {
+        Histogram merged;
+        std::lock_guard<std::mutex> lock(shardsMutex);
+        for (auto& shard : shards)
+        {
+            const std::atomic<uint64_t>* cells = shard->cells.get() + histogramOffset(group, stage);
+            for (size_t i = 0; i < BUCKETS; i++)
+            {
+                uint64_t count = cells[i].load(std::memory_order_relaxed);
+                merged.counts[i] += count;
+                merged.total += count;
+            }
+            merged.maxNanoseconds = std::max(merged.maxNanoseconds, (int64_t)cells[BUCKETS].load(std::memory_order_relaxed));
+        }
+        return merged;
+    }
+
+    uint64_t counter(size_t group, size_t counter)
+    {
+        uint64_t total = 0;
+        std::lock_guard<std::mutex> lock(shardsMutex);
+        for (auto& shard : shards)
+        {
+            total += shard->cells[counterOffset(group, counter)].load(std::memory_order_relaxed);
+        }
+        return total;
+    }
+
+private:
+    struct Shard
+    {
+        std::unique_ptr<std::atomic<uint64_t>[]> cells; // Each histogram's buckets and max, then the counters
+    };
+
+    const size_t groups;
+    const size_t stages;
+    const size_t counters;
+    const uint64_t id; // Tells instances apart in the thread-local shard lists
+    std::mutex shardsMutex;
+    std::vector<std::unique_ptr<Shard>> shards; // Kept after their thread exits, so nothing is lost
+
+    static inline std::atomic<uint64_t> nextId{ 1 };
+
+    size_t histogramOffset(size_t group, size_t stage) const
+    {
+        return (group * stages + stage) * (BUCKETS + 1);
+    }
+
+    size_t counterOffset(size_t group, size_t counter) const
+    {
+        return groups * stages * (BUCKETS + 1) + group * counters + counter;
+    }
+
+    // Only the owning thread writes a shard, so a load and a store is enough
+    static void bump(std::atomic<uint64_t>& cell, uint64_t amount = 1)
+    {
+        cell.store(cell.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+    }
+
+    Shard& localShard()
+    {
+        struct Entry
+        {
+            uint64_t owner;
+            Shard* shard;
+        };
+        thread_local std::vector<Entry> local; // Almost always one entry
+
+        for (const Entry& entry : local)
+        {
+            if (entry.owner == id) return *entry.shard;
+        }
+
+        size_t size = counterOffset(groups, 0);
+        auto shard = std::make_unique<Shard>();
+        shard->cells = std::make_unique<std::atomic<uint64_t>[]>(size);
+        for (size_t i = 0; i < size; i++) shard->cells[i].store(0, std::memory_order_relaxed);
+
+        Shard* raw = shard.get();
+        {
+            std::lock_guard<std::mutex> lock(shardsMutex);
+            shards.push_back(std::move(shard));
+        }
+        local.push_back({ id, raw });
+        return *raw;
+    }
+
+    static size_t bucketOf(uint64_t micros)
+    {
+        if (micros < SUB_BUCKETS) return (size_t)micros;
+        size_t octave = std::min<size_t>(std::bit_width(micros) - 1, MAX_OCTAVE - 1);
+        if (octave == MAX_OCTAVE - 1 && std::bit_width(micros) > MAX_OCTAVE) return BUCKETS - 1;
+        size_t sub = (size_t)(micros >> (octave - 3)) & (SUB_BUCKETS - 1);
+        return SUB_BUCKETS + (octave - 3) * SUB_BUCKETS + sub;
+    }
+
+    static double bucketLow(size_t index)
+    {
+        if (index < SUB_BUCKETS) return (double)index;
+        size_t octave = (index - SUB_BUCKETS) / SUB_BUCKETS + 3;
+        size_t sub = (index - SUB_BUCKETS) % SUB_BUCKETS;
+        return (double)((SUB_BUCKETS + sub) << (octave - 3));
+    }
+
+    static double bucketWidth(size_t index)
+    {
+        if (index < SUB_BUCKETS) return 1.0;
+        return (double)(1ull << ((index - SUB_BUCKETS) / SUB_BUCKETS));
+    }
+};
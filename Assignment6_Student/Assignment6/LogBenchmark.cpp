@@ -0,0 +1,80 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <filesystem>
+#include <cstdio>
+
+#include "Assignment6b.cpp"
+
+// Throughput of a durable PostQueue and how long recovery takes
+/*
+* -Adds posts to a queue with enableDurability() from one thread, with nothing taking them, and reports
+*  posts/s up to the last addPost and up to syncLog() (everything on disk)
+* -Then opens the log again and times enableDurability(), which replays it and re-queues every post
+* -The log goes in a scratch directory under the system temp directory, removed afterwards
+* Run with: Assignment6 --bench-log
+*/
+class LogBenchmark
+{
+public:
+    static void Execute()
+    {
+        const size_t posts = 500000;
+        std::filesystem::path directory = std::filesystem::temp_directory_path() / "Assignment6-log-bench";
+
+        std::cout << "Write-ahead log benchmark, " << posts << " posts, in " << directory.string() << std::endl;
+        std::printf("%-10s %-16s %-16s %-14s\n", "run", "added/s", "durable/s", "recovery ms");
+
+        for (int run = 1; run <= 3; run++)
+        {
+            std::filesystem::remove_all(directory);
+            double addRate, durableRate;
+            {
+                PostQueue queue(posts / PLATFORM_COUNT + 1); // Room for every post, so nothing waits on a full lane
+                queue.enableDurability(directory.string());
+
+                std::vector<std::string> contents;
+                contents.reserve(posts);
+                for (size_t i = 0; i < posts; i++)
+                {
+                    contents.push_back("Durable post number " + std::to_string(i));
+                }
+
+                auto start = std::chrono::steady_clock::now();
+                for (size_t i = 0; i < posts; i++)
+                {
+                    queue.addPost(Post::create(contents[i], (Platform)(i % PLATFORM_COUNT)));
+                }
+                addRate = posts / secondsSince(start);
+                queue.syncLog();
+                durableRate = posts / secondsSince(start);
+                queue.shutdown();
+            }
+
+            double recoveryMs;
+            {
+                PostQueue queue(posts / PLATFORM_COUNT + 1); // Room for every post, so nothing waits on a full lane
+                auto start = std::chrono::steady_clock::now();
+                size_t recovered = queue.enableDurability(directory.string());
+                recoveryMs = secondsSince(start) * 1000.0;
+                if (recovered != posts)
+                {
+                    std::cout << "Recovered " << recovered << " posts, expected " << posts << std::endl;
+                }
+                queue.shutdown();
+            }
+
+            std::printf("%-10d %-16.0f %-16.0f %-14.1f\n", run, addRate, durableRate, recoveryMs);
+        }
+        std::filesystem::remove_all(directory);
+    }
+
+private:
+    static double secondsSince(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+};
@@ -0,0 +1,286 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+
+// Lets threads sleep until something changes, without costing the wakers anything while nobody sleeps
+// (an "event count")
+// Usage: key = prepareWait(); re-check the condition; then wait(key) or cancelWait()
+class Parker
+{
+private:
+    std::atomic<uint32_t> epoch{ 0 };
+    std::atomic<uint32_t> waiters{ 0 };
+    std::mutex parkMutex;
+    std::condition_variable parkCV;
+
+public:
+    uint32_t prepareWait()
+    {
+        waiters.fetch_add(1, std::memory_order_seq_cst);
+        std::atomic_thread_fence(std::memory_order_seq_cst); // Pairs with the fence in notify*
+        return epoch.load(std::memory_order_seq_cst);
+    }
+
+    void cancelWait()
+    {
+        waiters.fetch_sub(1, std::memory_order_seq_cst);
+    }
+
+    // Returns false on timeout
+    template <typename Clock, typename Duration>
+    bool waitUntil(uint32_t key, const std::chrono::time_point<Clock, Duration>& deadline)
+    {
+        std::unique_lock<std::mutex> lock(parkMutex);
+        bool woken = parkCV.wait_until(lock, deadline, [&] { return epoch.load(std::memory_order_relaxed) != key; });
+        waiters.fetch_sub(1, std::memory_order_seq_cst);
+        return woken;
+    }
+
+    void wait(uint32_t key)
+    {
+        std::unique_lock<std::mutex> lock(parkMutex);
+        parkCV.wait(lock, [&] { return epoch.load(std::memory_order_relaxed) != key; });
+        waiters.fetch_sub(1, std::memory_order_seq_cst);
+    }
+
+    void notifyOne()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst); // Our change is visible before we look for waiters
+        if (waiters.load(std::memory_order_seq_cst) == 0) return; // The common case, nobody to wake
+        {
+            std::lock_guard<std::mutex> lock(parkMutex);
+            epoch.fetch_add(1, std::memory_order_relaxed);
+        }
+        parkCV.notify_one();
+    }
+
+    void notifyAll()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiters.load(std::memory_order_seq_cst) == 0) return;
+        {
+            std::lock_guard<std::mutex> lock(parkMutex);
+            epoch.fetch_add(1, std::memory_order_relaxed);
+        }
+        parkCV.notify_all();
+    }
+};
+
+// Bounded lock-free multi-producer multi-consumer queue (Vyukov)
+/*
+* -A ring of cells, each with a sequence number saying whether it is ready to be written or read
+* -Producers and consumers only contend on their own position counter, and only with one CAS
+* -try* never block, push/pop park on a Parker when the queue is full/empty
+* -After close(), pushes fail and pops drain what is left
+*/
+template <typename T>
+class MpmcQueue
+{
+private:
+    static constexpr size_t CACHE_LINE = 64;
+
+    struct Cell
+    {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    const size_t mask;
+    std::unique_ptr<Cell[]> cells;
+
+    alignas(CACHE_LINE) std::atomic<size_t> enqueuePos{ 0 };
+    alignas(CACHE_LINE) std::atomic<size_t> dequeuePos{ 0 };
+    alignas(CACHE_LINE) std::atomic<bool> closed{ false };
+    Parker notEmpty;
+    Parker notFull;
+
+    static size_t roundUp(size_t capacity)
+    {
+        size_t size = 2;
+        while (size < capacity) size <<= 1;
+        return size;
+    }
+
+public:
+    // The capacity is rounded up to a power of two
+    explicit MpmcQueue(size_t capacity = 1024)
+        : mask(roundUp(capacity) - 1), cells(new Cell[mask + 1])
+    {
+        for (size_t i = 0; i <= mask; i++)
+        {
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    MpmcQueue(const MpmcQueue&) = delete;
+    MpmcQueue& operator=(const MpmcQueue&) = delete;
+
+    bool tryPush(T& value)
+    {
+        size_t pos = enqueuePos.load(std::memory_order_relaxed);
+        while (true)
+        {
+            Cell& cell = cells[pos & mask];
+            size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+            if (diff == 0)
+            {
+                if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    cell.value = std::move(value);
+                    cell.sequence.store(pos + 1, std::memory_order_release);
+                    notEmpty.notifyOne();
+                    return true;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false; // Full
+            }
+            else
+            {
+                pos = enqueuePos.load(std::memory_order_relaxed); // Someone else took this cell
+            }
+        }
+    }
+
+    bool tryPop(T& value)
+    {
+        size_t pos = dequeuePos.load(std::memory_order_relaxed);
+        while (true)
+        {
+            Cell& cell = cells[pos & mask];
+            size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)sequence - (intptr_t)(pos + 1);
+            if (diff == 0)
+            {
+                if (dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    value = std::move(cell.value);
+                    cell.value = T(); // Don't keep the object alive from the ring
+                    cell.sequence.store(pos + mask + 1, std::memory_order_release);
+                    notFull.notifyOne();
+                    return true;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false; // Empty
+            }
+            else
+            {
+                pos = dequeuePos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Blocks while the queue is full. Returns false once the queue is closed.
+    bool push(T value)
+    {
+        while (!closed.load(std::memory_order_acquire))
+        {
+            if (tryPush(value)) return true;
+
+            uint32_t key = notFull.prepareWait();
+            if (tryPush(value))
+            {
+                notFull.cancelWait();
+                return true;
+            }
+            if (closed.load(std::memory_order_acquire))
+            {
+                notFull.cancelWait();
+                return false;
+            }
+            notFull.wait(key);
+        }
+        return false;
+    }
+
+    // Blocks while the queue is empty. Returns false once the queue is closed and drained.
+    bool pop(T& value)
+    {
+        while (true)
+        {
+            if (tryPop(value)) return true;
+            if (closed.load(std::memory_order_acquire)) return tryPop(value);
+
+            uint32_t key = notEmpty.prepareWait();
+            if (tryPop(value))
+            {
+                notEmpty.cancelWait();
+                return true;
+            }
+            if (closed.load(std::memory_order_acquire))
+            {
+                notEmpty.cancelWait();
+                return false;
+            }
+            notEmpty.wait(key);
+        }
+    }
+
+    // Like pop(), but gives up after `timeout`
+    template <typename Rep, typename Period>
+    bool popFor(T& value, const std::chrono::duration<Rep, Period>& timeout)
+    {
+        auto deadline = std::chrono::steady_clock::now() + timeout;
+        while (true)
+        {
+            if (tryPop(value)) return true;
+            if (closed.load(std::memory_order_acquire)) return tryPop(value);
+
+            uint32_t key = notEmpty.prepareWait();
+            if (tryPop(value))
+            {
+                notEmpty.cancelWait();
+                return true;
+            }
+            if (closed.load(std::memory_order_acquire))
+            {
+                notEmpty.cancelWait();
+                return false;
+            }
+            if (!notEmpty.waitUntil(key, deadline))
+            {
+                return tryPop(value);
+            }
+        }
+    }
+
+    void close()
+    {
+        closed.store(true, std::memory_order_release);
+        notEmpty.notifyAll();
+        notFull.notifyAll();
+    }
+
+    bool isClosed() const
+    {
+        return closed.load(std::memory_order_acquire);
+    }
+
+    // Only a snapshot, other threads may change it straight away
+    size_t sizeApprox() const
+    {
+        size_t tail = enqueuePos.load(std::memory_order_relaxed);
+        size_t head = dequeuePos.load(std::memory_order_relaxed);
+        return tail > head ? tail - head : 0;
+    }
+
+    bool isEmpty() const
+    {
+        return sizeApprox() == 0;
+    }
+
+    size_t capacity() const
+    {
+        return mask + 1;
+    }
+};
@@ -0,0 +1,182 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <cstdio>
+
+#include "Assignment6b.cpp"
+
+// The pool design the scheduler had before work stealing: one deque behind one mutex
+class SharedQueuePool
+{
+private:
+    std::vector<std::thread> workers;
+    std::mutex queueMutex;
+    std::condition_variable queueCV;
+    std::deque<std::function<void()>> jobs;
+    bool stop{ false };
+
+public:
+    explicit SharedQueuePool(size_t numThreads)
+    {
+        for (size_t i = 0; i < numThreads; i++)
+        {
+            workers.emplace_back([this]() {
+                workerFunction();
+                });
+        }
+    }
+
+    ~SharedQueuePool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            stop = true;
+        }
+        queueCV.notify_all();
+        for (auto& a : workers) a.join();
+    }
+
+    void execute(std::function<void()> work)
+    {
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            jobs.push_back(std::move(work));
+        }
+        queueCV.notify_one();
+    }
+
+private:
+    void workerFunction()
+    {
+        while (true)
+        {
+            std::function<void()> job;
+            {
+                std::unique_lock<std::mutex> lock(queueMutex);
+                queueCV.wait(lock, [this] { return stop || !jobs.empty(); });
+                if (jobs.empty()) return;
+                job = std::move(jobs.front());
+                jobs.pop_front();
+            }
+            job();
+        }
+    }
+};
+
+// Compares the work-stealing ThreadPool with the shared-queue design
+/*
+* -fork-join: every task spawns two children until the tree is deep enough, so most work is submitted by workers
+* -flat: one outside thread submits every task, the case a shared queue is best at
+* -Each task burns a little CPU so the scheduler overhead is visible but not everything
+* Run with: Assignment6 --bench
+*/
+class SchedulerBenchmark
+{
+public:
+    static void Execute()
+    {
+        const int depth = 15;          // 65535 tasks per fork-join run
+        const size_t flatTasks = 100000;
+
+        unsigned cores = std::thread::hardware_concurrency();
+        std::cout << "Scheduler benchmark, " << cores << " hardware threads, tasks/s" << std::endl;
+        std::printf("%-8s %-14s %-16s %-16s\n", "threads", "design", "fork-join", "flat");
+
+        for (size_t threads : { 1, 2, 4, 8, 16, 32, 64 })
+        {
+            {
+                SharedQueuePool pool(threads);
+                report(threads, "shared-queue", forkJoin(pool, depth), flat(pool, flatTasks));
+            }
+            {
+                ThreadPool pool(threads);
+                report(threads, "work-stealing", forkJoin(pool, depth), flat(pool, flatTasks));
+            }
+        }
+    }
+
+private:
+    // Lets the caller sleep until the last task is done
+    struct Countdown
+    {
+        std::atomic<int64_t> remaining;
+        std::atomic<bool> done{ false };
+
+        explicit Countdown(int64_t count) : remaining(count) {}
+
+        void finish()
+        {
+            if (remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            {
+                done.store(true, std::memory_order_release);
+                done.notify_all();
+            }
+        }
+
+        void wait()
+        {
+            done.wait(false, std::memory_order_acquire);
+        }
+    };
+
+    static void burn()
+    {
+        volatile uint32_t x = 1;
+        for (int i = 0; i < 200; i++) x = x * 1664525u + 1013904223u;
+    }
+
+    template <typename Pool>
+    static void spawn(Pool& pool, Countdown& countdown, int depth)
+    {
+        if (depth > 0)
+        {
+            pool.execute([&pool, &countdown, depth] { spawn(pool, countdown, depth - 1); });
+            pool.execute([&pool, &countdown, depth] { spawn(pool, countdown, depth - 1); });
+        }
+        burn();
+        countdown.finish();
+    }
+
+    template <typename Pool>
+    static double forkJoin(Pool& pool, int depth)
+    {
+        int64_t tasks = (int64_t(1) << (depth + 1)) - 1;
+        Countdown countdown(tasks);
+        auto start = std::chrono::steady_clock::now();
+        pool.execute([&pool, &countdown, depth] { spawn(pool, countdown, depth); });
+        countdown.wait();
+        return tasks / secondsSince(start);
+    }
+
+    template <typename Pool>
+    static double flat(Pool& pool, size_t tasks)
+    {
+        Countdown countdown((int64_t)tasks);
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < tasks; i++)
+        {
+            pool.execute([&countdown] { burn(); countdown.finish(); });
+        }
+        countdown.wait();
+        return tasks / secondsSince(start);
+    }
+
+    static double secondsSince(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    static void report(size_t threads, const char* design, double forkJoinRate, double flatRate)
+    {
+        std::printf("%-8zu %-14s %-16.0f %-16.0f\n", threads, design, forkJoinRate, flatRate);
+    }
+};
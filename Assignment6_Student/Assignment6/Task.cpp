@@ -0,0 +1,233 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <memory>
+#include <utility>
+#include <type_traits>
+#include <vector>
+
+#include "MpmcQueue.cpp"
+
+// Move-only void() callable with small-buffer optimization
+/*
+* -Callables up to INLINE_SIZE bytes (that can be moved without throwing) live inside the Task, no allocation
+* -Bigger ones go on the heap, like std::function
+* -Unlike std::function it can hold move-only callables (promises, unique_ptrs)
+*/
+class Task
+{
+public:
+    static constexpr size_t INLINE_SIZE = 48;
+
+    Task() = default;
+
+    template <typename F, typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, Task>>>
+    Task(F&& function)
+    {
+        typedef std::decay_t<F> Callable;
+        if constexpr (fitsInline<Callable>())
+        {
+            new (storage) Callable(std::forward<F>(function));
+            ops = &inlineOps<Callable>;
+        }
+        else
+        {
+            *reinterpret_cast<Callable**>(storage) = new Callable(std::forward<F>(function));
+            ops = &heapOps<Callable>;
+        }
+    }
+
+    Task(Task&& other) noexcept
+    {
+        moveFrom(other);
+    }
+
+    Task& operator=(Task&& other) noexcept
+    {
+        if (this != &other)
+        {
+            reset();
+            moveFrom(other);
+        }
+        return *this;
+    }
+
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    ~Task()
+    {
+        reset();
+    }
+
+    void operator()()
+    {
+        ops->invoke(storage);
+    }
+
+    explicit operator bool() const
+    {
+        return ops != nullptr;
+    }
+
+    // True if the callable lives in the inline buffer
+    bool isInline() const
+    {
+        return ops != nullptr && ops->isInline;
+    }
+
+    void reset()
+    {
+        if (ops)
+        {
+            ops->destroy(storage);
+            ops = nullptr;
+        }
+    }
+
+private:
+    struct Ops
+    {
+        void (*invoke)(void* storage);
+        void (*move)(void* from, void* to); // Move into raw storage and destroy the source
+        void (*destroy)(void* storage);
+        bool isInline;
+    };
+
+    alignas(std::max_align_t) unsigned char storage[INLINE_SIZE];
+    const Ops* ops = nullptr;
+
+    template <typename Callable>
+    static constexpr bool fitsInline()
+    {
+        return sizeof(Callable) <= INLINE_SIZE && alignof(Callable) <= alignof(std::max_align_t)
+            && std::is_nothrow_move_constructible_v<Callable>;
+    }
+
+    template <typename Callable>
+    static constexpr Ops inlineOps = {
+        [](void* storage) { (*std::launder(reinterpret_cast<Callable*>(storage)))(); },
+        [](void* from, void* to) {
+            Callable* source = std::launder(reinterpret_cast<Callable*>(from));
+            new (to) Callable(std::move(*source));
+            source->~Callable();
+        },
+        [](void* storage) { std::launder(reinterpret_cast<Callable*>(storage))->~Callable(); },
+        true
+    };
+
+    template <typename Callable>
+    static constexpr Ops heapOps = {
+        [](void* storage) { (**reinterpret_cast<Callable**>(storage))(); },
+        [](void* from, void* to) { *reinterpret_cast<Callable**>(to) = *reinterpret_cast<Callable**>(from); },
+        [](void* storage) { delete *reinterpret_cast<Callable**>(storage); },
+        false
+    };
+
+    void moveFrom(Task& other) noexcept
+    {
+        if (other.ops)
+        {
+            other.ops->move(other.storage, storage);
+            ops = other.ops;
+            other.ops = nullptr;
+        }
+    }
+};
+
+// A Task in its own node, for queues that can only hold pointers
+struct TaskNode
+{
+    Task task;
+    int64_t enqueuedAt = 0; // Set on a sample of nodes by pools that measure queueing delay
+};
+
+// Recycles TaskNodes, so submitting a task doesn't go to the allocator once the pool is warm
+/*
+* -Each thread keeps a small cache of free nodes
+* -Overflow goes to a shared lock-free pool, where threads that only submit pick them up again
+*/
+class TaskNodePool
+{
+public:
+    static TaskNode* acquire(Task&& task)
+    {
+        TaskNode* node = nullptr;
+        std::vector<TaskNode*>& cache = localCache().nodes;
+        if (!cache.empty())
+        {
+            node = cache.back();
+            cache.pop_back();
+        }
+        else if (!shared().nodes.tryPop(node))
+        {
+            node = new TaskNode();
+        }
+        node->task = std::move(task);
+        return node;
+    }
+
+    static void release(TaskNode* node)
+    {
+        node->task.reset();
+        std::vector<TaskNode*>& cache = localCache().nodes;
+        if (cache.size() < LOCAL_LIMIT)
+        {
+            cache.push_back(node);
+        }
+        else if (!shared().nodes.tryPush(node))
+        {
+            delete node;
+        }
+    }
+
+private:
+    static constexpr size_t LOCAL_LIMIT = 256;
+    static constexpr size_t SHARED_LIMIT = 4096;
+
+    struct SharedNodes
+    {
+        MpmcQueue<TaskNode*> nodes{ SHARED_LIMIT };
+
+        ~SharedNodes()
+        {
+            TaskNode* node;
+            while (nodes.tryPop(node)) delete node;
+        }
+    };
+
+    struct LocalCache
+    {
+        std::vector<TaskNode*> nodes;
+
+        ~LocalCache() // Hand the nodes on when the thread exits
+        {
+            for (TaskNode* node : nodes)
+            {
+                if (!shared().nodes.tryPush(node)) delete node;
+            }
+        }
+    };
+
+    static SharedNodes& shared()
+    {
+        static SharedNodes nodes;
+        return nodes;
+    }
+
+    static LocalCache& localCache()
+    {
+        thread_local LocalCache cache;
+        return cache;
+    }
+};
+
+// Anything that can run Tasks, so code that only needs somewhere to run work doesn't depend on ThreadPool
+class Executor
+{
+public:
+    virtual ~Executor() = default;
+    virtual void execute(Task work) = 0;
+};
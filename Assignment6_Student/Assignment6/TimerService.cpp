@@ -0,0 +1,412 @@
+#pragma once
+
+#include <vector>
+#include <array>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cstdint>
+#include <bit>
+#include <algorithm>
+
+#include "Task.cpp"
+
+// Runs callbacks at a given time on one timer thread
+/*
+* -Hierarchical timing wheel: 4 levels of 256 slots with 1 ms ticks, which covers about 49 days
+* -A timer goes on the level where its deadline first differs from the current tick and moves down
+*  a level each time the wheel reaches its slot, so inserting and cancelling are O(1)
+* -Timers further out than the wheel wait in a 4-ary heap until they come into range
+* -The thread sleeps until the next slot that has something in it, it never polls or ticks through empty time
+* -Callbacks never run early, and run on the timer thread, so they should only hand work on (to an Executor)
+*/
+class TimerService
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+    typedef uint64_t TimerId;
+
+    static constexpr TimerId NO_TIMER = 0;
+
+    TimerService()
+        : origin(Clock::now())
+    {
+        heads.fill(NONE);
+        tails.fill(NONE);
+        timerThread = std::thread([this] { this->timerLoop(); });
+    }
+
+    ~TimerService()
+    {
+        {
+            std::lock_guard<std::mutex> lock(timerMutex);
+            stop = true;
+        }
+        timerCV.notify_one();
+        timerThread.join();
+    }
+
+    TimerService(const TimerService&) = delete;
+    TimerService& operator=(const TimerService&) = delete;
+
+    // The id can be passed to cancel() until the callback starts
+    TimerId schedule(Clock::time_point deadline, Task callback)
+    {
+        uint64_t tick = toTick(deadline, true);
+        bool earlier;
+        TimerId id;
+        {
+            std::lock_guard<std::mutex> lock(timerMutex);
+            uint32_t index = allocate();
+            Timer& timer = nodes[index];
+            timer.tick = tick;
+            timer.callback = std::move(callback);
+            id = ((TimerId)timer.generation << 32) | (index + 1);
+            place(index);
+            live++;
+            earlier = tick < wakeTick;
+        }
+        if (earlier) // Only then does the thread have to wake up sooner
+        {
+            timerCV.notify_one();
+        }
+        return id;
+    }
+
+    // Returns false if the timer already ran (or is running), or was cancelled before
+    bool cancel(TimerId id)
+    {
+        Task dropped; // Destroyed after the lock is released
+        uint32_t index = (uint32_t)id - 1;
+        uint32_t generation = (uint32_t)(id >> 32);
+
+        std::lock_guard<std::mutex> lock(timerMutex);
+        if (id == NO_TIMER || index >= nodes.size()) return false;
+        Timer& timer = nodes[index];
+        if (timer.generation != generation || timer.list == NONE) return false;
+
+        unlink(index);
+        dropped = std::move(timer.callback);
+        releaseNode(index);
+        live--;
+        return true;
+    }
+
+    // Timers that have not run yet
+    size_t pending()
+    {
+        std::lock_guard<std::mutex> lock(timerMutex);
+        return live;
+    }
+
+private:
+    static constexpr int LEVELS = 4;
+    static constexpr int SLOT_BITS = 8;
+    static constexpr uint32_t SLOTS = 1 << SLOT_BITS;
+    static constexpr int WHEEL_BITS = LEVELS * SLOT_BITS;
+    static constexpr uint32_t DUE_LIST = LEVELS * SLOTS; // Timers whose tick has been reached
+    static constexpr uint32_t FAR_HEAP = DUE_LIST + 1;
+    static constexpr uint32_t NONE = UINT32_MAX;
+    static constexpr uint64_t NEVER = UINT64_MAX;
+
+    struct Timer
+    {
+        Task callback;
+        uint64_t tick = 0;
+        uint32_t generation = 1;   // Bumped on reuse, so stale ids don't cancel someone else's timer
+        uint32_t list = NONE;      // Slot list, DUE_LIST or FAR_HEAP; NONE while free
+        uint32_t prev = NONE;
+        uint32_t next = NONE;      // Also links the free nodes
+        uint32_t heapIndex = NONE;
+    };
+
+    const Clock::time_point origin;
+    std::mutex timerMutex;
+    std::condition_variable timerCV;
+
+    std::vector<Timer> nodes;
+    uint32_t freeNodes = NONE;
+    size_t live = 0;
+
+    std::array<uint32_t, DUE_LIST + 1> heads;
+    std::array<uint32_t, DUE_LIST + 1> tails;
+    uint64_t occupied[LEVELS][SLOTS / 64] = {}; // Which slots have timers, to skip empty ones
+    std::vector<uint32_t> farTimers;            // 4-ary min-heap on tick
+
+    uint64_t currentTick = 0;
+    uint64_t wakeTick = 0; // When the sleeping thread will wake up by itself, 0 while it is awake
+    bool stop = false;
+    std::vector<Task> firing; // Only used by the timer thread
+    std::thread timerThread;
+
+    uint64_t toTick(Clock::time_point time, bool roundUp) const
+    {
+        if (time <= origin) return 0;
+        Clock::duration elapsed = time - origin;
+        uint64_t ticks = (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count();
+        if (roundUp && std::chrono::milliseconds(ticks) < elapsed) ticks++;
+        return ticks;
+    }
+
+    uint32_t allocate()
+    {
+        if (freeNodes != NONE)
+        {
+            uint32_t index = freeNodes;
+            freeNodes = nodes[index].next;
+            return index;
+        }
+        nodes.emplace_back();
+        return (uint32_t)(nodes.size() - 1);
+    }
+
+    void releaseNode(uint32_t index)
+    {
+        Timer& timer = nodes[index];
+        timer.generation++;
+        timer.list = NONE;
+        timer.next = freeNodes;
+        freeNodes = index;
+    }
+
+    // Put the timer where it belongs relative to currentTick
+    void place(uint32_t index)
+    {
+        uint64_t tick = nodes[index].tick;
+        if (tick <= currentTick)
+        {
+            link(index, DUE_LIST);
+            return;
+        }
+
+        uint64_t differs = tick ^ currentTick;
+        if (differs >> WHEEL_BITS)
+        {
+            farPush(index);
+            return;
+        }
+
+        uint32_t level = (uint32_t)(std::bit_width(differs) - 1) / SLOT_BITS;
+        uint32_t slot = (uint32_t)(tick >> (level * SLOT_BITS)) & (SLOTS - 1);
+        link(index, level * SLOTS + slot);
+    }
+
+    void link(uint32_t index, uint32_t list)
+    {
+        Timer& timer = nodes[index];
+        timer.list = list;
+        timer.next = NONE;
+        timer.prev = tails[list];
+        if (tails[list] != NONE) nodes[tails[list]].next = index;
+        else heads[list] = index;
+        tails[list] = index;
+
+        if (list < DUE_LIST)
+        {
+            occupied[list / SLOTS][(list % SLOTS) / 64] |= 1ull << (list % 64);
+        }
+    }
+
+    void unlink(uint32_t index)
+    {
+        Timer& timer = nodes[index];
+        if (timer.list == FAR_HEAP)
+        {
+            farRemove(timer.heapIndex);
+        }
+        else
+        {
+            uint32_t list = timer.list;
+            if (timer.prev != NONE) nodes[timer.prev].next = timer.next;
+            else heads[list] = timer.next;
+            if (timer.next != NONE) nodes[timer.next].prev = timer.prev;
+            else tails[list] = timer.prev;
+
+            if (heads[list] == NONE && list < DUE_LIST)
+            {
+                occupied[list / SLOTS][(list % SLOTS) / 64] &= ~(1ull << (list % 64));
+            }
+        }
+        timer.list = NONE;
+    }
+
+    // First slot at or after `from` on this level that has timers, or SLOTS
+    uint32_t nextOccupied(uint32_t level, uint32_t from) const
+    {
+        for (uint32_t word = from / 64; word < SLOTS / 64; word++)
+        {
+            uint64_t bits = occupied[level][word];
+            if (word == from / 64) bits &= ~0ull << (from % 64);
+            if (bits) return word * 64 + (uint32_t)std::countr_zero(bits);
+        }
+        return SLOTS;
+    }
+
+    // The next tick at which a timer fires or has to move down a level
+    uint64_t nextEvent() const
+    {
+        if (heads[DUE_LIST] != NONE) return currentTick;
+
+        uint64_t next = NEVER;
+        for (uint32_t level = 0; level < LEVELS; level++)
+        {
+            uint32_t shift = level * SLOT_BITS;
+            uint32_t current = (uint32_t)(currentTick >> shift) & (SLOTS - 1);
+            uint32_t slot = nextOccupied(level, current + 1);
+            if (slot < SLOTS)
+            {
+                uint64_t above = currentTick >> (shift + SLOT_BITS) << (shift + SLOT_BITS);
+                next = std::min(next, above | ((uint64_t)slot << shift));
+            }
+        }
+        if (!farTimers.empty())
+        {
+            uint64_t tick = nodes[farTimers[0]].tick;
+            next = std::min(next, tick >> WHEEL_BITS << WHEEL_BITS); // When it comes into the wheel's range
+        }
+        return next;
+    }
+
+    // Move the wheel to `tick` (an event tick): far timers come in, the slots it reaches move down a level
+    void advanceTo(uint64_t tick)
+    {
+        currentTick = tick;
+        while (!farTimers.empty() && (nodes[farTimers[0]].tick >> WHEEL_BITS) <= (tick >> WHEEL_BITS))
+        {
+            uint32_t index = farTimers[0];
+            farRemove(0);
+            place(index);
+        }
+        for (int level = LEVELS - 1; level >= 0; level--)
+        {
+            uint32_t list = level * SLOTS + ((uint32_t)(tick >> (level * SLOT_BITS)) & (SLOTS - 1));
+            uint32_t index = heads[list];
+            if (index == NONE) continue;
+
+            heads[list] = tails[list] = NONE;
+            occupied[level][(list % SLOTS) / 64] &= ~(1ull << (list % 64));
+            while (index != NONE)
+            {
+                uint32_t next = nodes[index].next;
+                place(index);
+                index = next;
+            }
+        }
+    }
+
+    void collectDue()
+    {
+        uint32_t index = heads[DUE_LIST];
+        heads[DUE_LIST] = tails[DUE_LIST] = NONE;
+        while (index != NONE)
+        {
+            uint32_t next = nodes[index].next;
+            firing.push_back(std::move(nodes[index].callback));
+            releaseNode(index);
+            live--;
+            index = next;
+        }
+    }
+
+    void farSet(size_t position, uint32_t index)
+    {
+        farTimers[position] = index;
+        nodes[index].heapIndex = (uint32_t)position;
+    }
+
+    void farPush(uint32_t index)
+    {
+        nodes[index].list = FAR_HEAP;
+        farTimers.push_back(index);
+        farSiftUp(farTimers.size() - 1);
+    }
+
+    void farRemove(size_t position)
+    {
+        uint32_t last = farTimers.back();
+        farTimers.pop_back();
+        if (position == farTimers.size()) return;
+
+        farSet(position, last);
+        if (position > 0 && nodes[last].tick < nodes[farTimers[(position - 1) / 4]].tick)
+        {
+            farSiftUp(position);
+        }
+        else
+        {
+            farSiftDown(position);
+        }
+    }
+
+    void farSiftUp(size_t position)
+    {
+        uint32_t index = farTimers[position];
+        while (position > 0)
+        {
+            size_t parent = (position - 1) / 4;
+            if (nodes[farTimers[parent]].tick <= nodes[index].tick) break;
+            farSet(position, farTimers[parent]);
+            position = parent;
+        }
+        farSet(position, index);
+    }
+
+    void farSiftDown(size_t position)
+    {
+        uint32_t index = farTimers[position];
+        size_t count = farTimers.size();
+        while (true)
+        {
+            size_t first = position * 4 + 1;
+            if (first >= count) break;
+            size_t best = first;
+            for (size_t child = first + 1; child < std::min(first + 4, count); child++)
+            {
+                if (nodes[farTimers[child]].tick < nodes[farTimers[best]].tick) best = child;
+            }
+            if (nodes[index].tick <= nodes[farTimers[best]].tick) break;
+            farSet(position, farTimers[best]);
+            position = best;
+        }
+        farSet(position, index);
+    }
+
+    void timerLoop()
+    {
+        std::unique_lock<std::mutex> lock(timerMutex);
+        while (!stop)
+        {
+            uint64_t now = toTick(Clock::now(), false);
+            uint64_t tick;
+            while ((tick = nextEvent()) <= now)
+            {
+                advanceTo(tick);
+                collectDue();
+            }
+
+            if (!firing.empty())
+            {
+                lock.unlock();
+                for (Task& callback : firing)
+                {
+                    callback();
+                }
+                firing.clear();
+                lock.lock();
+                continue;
+            }
+
+            wakeTick = tick;
+            if (tick == NEVER)
+            {
+                timerCV.wait(lock);
+            }
+            else
+            {
+                timerCV.wait_until(lock, origin + std::chrono::milliseconds(tick));
+            }
+            wakeTick = 0;
+        }
+    }
+};
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+
+// Token bucket rate limiter
+/*
+* -`rate` tokens per second, up to `burst` saved up while idle
+* -Kept as one atomic "time the bucket is paid up to" (the GCRA form of a token bucket),
+*  so taking tokens is a CAS and there is no refill thread or lock
+*/
+class TokenBucket
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    TokenBucket(double rate, size_t burst)
+        : interval(std::max<int64_t>(1, (int64_t)(1e9 / rate))),
+        tolerance(interval * (int64_t)std::max<size_t>(burst, 1)),
+        origin(Clock::now()) {}
+
+    // Takes up to `wanted` tokens and returns how many it got
+    // If it got none, `retryIn` says how long until the next one
+    size_t tryAcquire(size_t wanted, Clock::duration& retryIn)
+    {
+        int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - origin).count();
+        int64_t paidUpTo = theoretical.load(std::memory_order_relaxed);
+        while (true)
+        {
+            int64_t start = std::max(paidUpTo, now);
+            int64_t available = (now + tolerance - start) / interval;
+            if (available <= 0)
+            {
+                retryIn = std::chrono::nanoseconds(start + interval - tolerance - now);
+                return 0;
+            }
+
+            size_t granted = std::min<size_t>(wanted, (size_t)available);
+            if (theoretical.compare_exchange_weak(paidUpTo, start + (int64_t)granted * interval, std::memory_order_relaxed))
+            {
+                return granted;
+            }
+        }
+    }
+
+    // Give back tokens that were taken but not used
+    void refund(size_t count)
+    {
+        theoretical.fetch_sub((int64_t)count * interval, std::memory_order_relaxed);
+    }
+
+private:
+    const int64_t interval;  // Nanoseconds per token
+    const int64_t tolerance; // How far ahead of now the bucket may be paid, i.e. the burst
+    const Clock::time_point origin;
+    std::atomic<int64_t> theoretical{ 0 };
+};
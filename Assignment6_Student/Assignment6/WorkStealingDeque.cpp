@@ -0,0 +1,140 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+// Chase-Lev work-stealing deque (the C11 version by Le, Pop, Cohen and Zappa Nardelli)
+/*
+* -The owning worker pushes and pops at the bottom without any CAS, except for the last item
+* -Other workers steal from the top with one CAS, so they rarely touch the owner's cache lines
+* -Grows when full; old arrays are kept until the deque goes away since a thief may still be reading one
+* -T must be trivially copyable (normally a pointer)
+*/
+template <typename T>
+class WorkStealingDeque
+{
+    static_assert(std::is_trivially_copyable<T>::value, "WorkStealingDeque holds pointers or plain values");
+
+private:
+    static constexpr size_t CACHE_LINE = 64;
+
+    struct Array
+    {
+        const int64_t capacity;
+        const int64_t mask;
+        std::unique_ptr<std::atomic<T>[]> slots;
+
+        explicit Array(int64_t capacity)
+            : capacity(capacity), mask(capacity - 1), slots(new std::atomic<T>[capacity]) {}
+
+        T get(int64_t index) const { return slots[index & mask].load(std::memory_order_relaxed); }
+        void put(int64_t index, T value) { slots[index & mask].store(value, std::memory_order_relaxed); }
+
+        Array* grow(int64_t top, int64_t bottom) const
+        {
+            Array* bigger = new Array(capacity * 2);
+            for (int64_t i = top; i < bottom; i++)
+            {
+                bigger->put(i, get(i));
+            }
+            return bigger;
+        }
+    };
+
+    alignas(CACHE_LINE) std::atomic<int64_t> top{ 0 };
+    alignas(CACHE_LINE) std::atomic<int64_t> bottom{ 0 };
+    std::atomic<Array*> array;
+    std::vector<std::unique_ptr<Array>> retired; // Only touched by the owner
+
+public:
+    explicit WorkStealingDeque(int64_t capacity = 256)
+        : array(new Array(capacity)) {}
+
+    ~WorkStealingDeque()
+    {
+        delete array.load(std::memory_order_relaxed);
+    }
+
+    WorkStealingDeque(const WorkStealingDeque&) = delete;
+    WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
+
+    // Owner only
+    void push(T value)
+    {
+        int64_t b = bottom.load(std::memory_order_relaxed);
+        int64_t t = top.load(std::memory_order_acquire);
+        Array* a = array.load(std::memory_order_relaxed);
+        if (b - t > a->capacity - 1)
+        {
+            retired.emplace_back(a);
+            a = a->grow(t, b);
+            array.store(a, std::memory_order_release);
+        }
+        a->put(b, value);
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom.store(b + 1, std::memory_order_relaxed);
+    }
+
+    // Owner only, takes the most recently pushed item
+    bool pop(T& value)
+    {
+        int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+        Array* a = array.load(std::memory_order_relaxed);
+        bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = top.load(std::memory_order_relaxed);
+
+        if (t > b) // Empty
+        {
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return false;
+        }
+
+        value = a->get(b);
+        if (t == b) // Last item, race the thieves for it
+        {
+            bool won = top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return won;
+        }
+        return true;
+    }
+
+    // Any thread, takes the oldest item
+    bool steal(T& value)
+    {
+        int64_t t = top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = bottom.load(std::memory_order_acquire);
+        if (t >= b)
+        {
+            return false;
+        }
+
+        Array* a = array.load(std::memory_order_acquire);
+        T stolen = a->get(t);
+        if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+        {
+            return false; // Lost to the owner or another thief
+        }
+        value = stolen;
+        return true;
+    }
+
+    // Only a snapshot
+    bool isEmpty() const
+    {
+        return bottom.load(std::memory_order_relaxed) <= top.load(std::memory_order_relaxed);
+    }
+
+    // Only a snapshot
+    size_t sizeApprox() const
+    {
+        int64_t size = bottom.load(std::memory_order_relaxed) - top.load(std::memory_order_relaxed);
+        return size > 0 ? (size_t)size : 0;
+    }
+};
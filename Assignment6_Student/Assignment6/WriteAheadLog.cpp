@@ -0,0 +1,515 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <array>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <filesystem>
+#include <algorithm>
+#include <stdexcept>
+#include <iostream>
+#include <syncstream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "Task.cpp"
+
+// One append-only segment file
+class SegmentFile
+{
+private:
+#ifdef _WIN32
+    HANDLE handle = INVALID_HANDLE_VALUE;
+#else
+    int fd = -1;
+#endif
+
+public:
+    SegmentFile() = default;
+    SegmentFile(const SegmentFile&) = delete;
+    SegmentFile& operator=(const SegmentFile&) = delete;
+
+    ~SegmentFile()
+    {
+        close();
+    }
+
+    bool isOpen() const
+    {
+#ifdef _WIN32
+        return handle != INVALID_HANDLE_VALUE;
+#else
+        return fd >= 0;
+#endif
+    }
+
+    bool open(const std::string& path)
+    {
+        close();
+#ifdef _WIN32
+        handle = CreateFileA(path.c_str(), FILE_APPEND_DATA, FILE_SHARE_READ, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+#else
+        fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+#endif
+        return isOpen();
+    }
+
+    bool write(const char* data, size_t size)
+    {
+        while (size > 0)
+        {
+#ifdef _WIN32
+            DWORD written = 0;
+            DWORD chunk = (DWORD)std::min<size_t>(size, 1u << 30);
+            if (!WriteFile(handle, data, chunk, &written, nullptr)) return false;
+#else
+            ssize_t written = ::write(fd, data, size);
+            if (written < 0) return false;
+#endif
+            data += written;
+            size -= (size_t)written;
+        }
+        return true;
+    }
+
+    // Data only, not metadata like the modification time
+    bool sync()
+    {
+#ifdef _WIN32
+        return FlushFileBuffers(handle) != 0;
+#elif defined(__APPLE__)
+        return fsync(fd) == 0;
+#else
+        return fdatasync(fd) == 0;
+#endif
+    }
+
+    void close()
+    {
+        if (!isOpen()) return;
+#ifdef _WIN32
+        CloseHandle(handle);
+        handle = INVALID_HANDLE_VALUE;
+#else
+        ::close(fd);
+        fd = -1;
+#endif
+    }
+};
+
+// A whole segment mapped read-only, for recovery
+class MappedSegment
+{
+private:
+    const char* bytes = nullptr;
+    size_t length = 0;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#endif
+
+public:
+    explicit MappedSegment(const std::string& path)
+    {
+#ifdef _WIN32
+        file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) return;
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) return;
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!mapping) return;
+        bytes = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+        if (bytes) length = (size_t)size.QuadPart;
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return;
+        struct stat info;
+        if (fstat(fd, &info) == 0 && info.st_size > 0)
+        {
+            void* mapped = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped != MAP_FAILED)
+            {
+                madvise(mapped, (size_t)info.st_size, MADV_SEQUENTIAL);
+                bytes = static_cast<const char*>(mapped);
+                length = (size_t)info.st_size;
+            }
+        }
+        ::close(fd);
+#endif
+    }
+
+    ~MappedSegment()
+    {
+#ifdef _WIN32
+        if (bytes) UnmapViewOfFile(bytes);
+        if (mapping) CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+#else
+        if (bytes) munmap(const_cast<char*>(bytes), length);
+#endif
+    }
+
+    MappedSegment(const MappedSegment&) = delete;
+    MappedSegment& operator=(const MappedSegment&) = delete;
+
+    const char* data() const { return bytes; }
+    size_t size() const { return length; }
+};
+
+// Segmented write-ahead log with group commit
+/*
+* -Records are (type, payload) pairs framed as [payload length u32][crc32 u32][type u8][payload]
+* -append() only copies the record into a buffer; one flusher thread writes everything appended during
+*  a commit window and makes it durable with one sync (fdatasync / FlushFileBuffers) for the whole group
+* -Each append can carry a Task that runs once the record is durable
+* -The log is split into segment files; a record can be retained, and segments are deleted oldest first,
+*  once the log has moved past them and their retained records have all been discarded
+* -Only the oldest run of such segments goes: a later one may hold records (e.g. statuses) about
+*  records in an older segment that is still needed, and deleting it would bring those back on replay
+* -replay() maps each segment and reads it front to back, stopping at the first torn or corrupt record
+* -A failed write or sync stops the process: after a failed fsync, what is on disk is unknown
+*/
+class WriteAheadLog
+{
+public:
+    typedef uint64_t RecordId; // Segment number in the high 32 bits, record number in the segment below
+
+    static constexpr size_t HEADER_SIZE = 9;
+
+    struct Options
+    {
+        std::chrono::microseconds commitWindow{ 1000 }; // How long the flusher gathers appends before syncing
+        size_t segmentBytes = 64 << 20;
+        size_t maxBuffered = 64 << 20;                  // append() waits while this much is not yet written
+    };
+
+    explicit WriteAheadLog(const std::string& directory)
+        : WriteAheadLog(directory, Options()) {}
+
+    WriteAheadLog(const std::string& directory, const Options& options)
+        : directory(directory), options(options)
+    {
+        std::filesystem::create_directories(directory);
+        for (const auto& entry : std::filesystem::directory_iterator(directory))
+        {
+            uint32_t segment;
+            if (parseSegmentName(entry.path().filename().string(), segment))
+            {
+                existing.push_back(segment);
+            }
+        }
+        std::sort(existing.begin(), existing.end());
+    }
+
+    ~WriteAheadLog()
+    {
+        if (flusherThread.joinable())
+        {
+            {
+                std::lock_guard<std::mutex> lock(logMutex);
+                stopping = true;
+            }
+            flushCV.notify_all();
+            flusherThread.join();
+        }
+    }
+
+    WriteAheadLog(const WriteAheadLog&) = delete;
+    WriteAheadLog& operator=(const WriteAheadLog&) = delete;
+
+    // Calls visit(id, type, payload) for every intact record, oldest first. Only before start().
+    // Returns how many records it read.
+    template <typename Visit>
+    size_t replay(Visit&& visit)
+    {
+        size_t records = 0;
+        for (uint32_t segment : existing)
+        {
+            MappedSegment mapped(segmentPath(segment));
+            const char* data = mapped.data();
+            size_t size = mapped.size();
+            size_t offset = 0;
+            uint32_t index = 0;
+            while (offset + HEADER_SIZE <= size)
+            {
+                uint32_t length = readU32(data + offset);
+                uint32_t checksum = readU32(data + offset + 4);
+                if (length > size - offset - HEADER_SIZE) break; // Torn write at the end
+                if (crc32(data + offset + 8, length + 1) != checksum) break;
+
+                visit(((RecordId)segment << 32) | index, (uint8_t)data[offset + 8], std::string_view(data + offset + HEADER_SIZE, length));
+                offset += HEADER_SIZE + length;
+                index++;
+                records++;
+            }
+            liveBySegment.emplace(segment, 0);
+        }
+        return records;
+    }
+
+    // Opens a fresh segment and starts the flusher. Replayed segments without retained records are deleted.
+    void start()
+    {
+        std::lock_guard<std::mutex> lock(logMutex);
+        appendSegment = existing.empty() ? 1 : existing.back() + 1;
+        liveBySegment.emplace(appendSegment, 0);
+        collectDead();
+        existing.clear();
+        flusherThread = std::thread([this] { this->flusherLoop(); });
+    }
+
+    // Copies a record into the log. `fill(id, payload)` writes exactly `size` payload bytes.
+    // A retained record keeps its segment on disk until discard(). `onDurable` runs on the flusher thread.
+    template <typename Fill>
+    RecordId append(uint8_t type, size_t size, Fill&& fill, bool retained, Task onDurable = {})
+    {
+        std::unique_lock<std::mutex> lock(logMutex);
+        spaceCV.wait(lock, [this] { return buffer.size() < options.maxBuffered || stopping; });
+
+        size_t recordSize = HEADER_SIZE + size;
+        if (appendBytes > 0 && appendBytes + recordSize > options.segmentBytes)
+        {
+            appendSegment++;
+            appendBytes = 0;
+            appendIndex = 0;
+            liveBySegment.emplace(appendSegment, 0);
+            switches.push_back({ buffer.size(), appendSegment });
+            collectDead();
+        }
+
+        RecordId id = ((RecordId)appendSegment << 32) | appendIndex++;
+        size_t offset = buffer.size();
+        buffer.resize(offset + recordSize);
+        char* record = buffer.data() + offset;
+        writeU32(record, (uint32_t)size);
+        record[8] = (char)type;
+        fill(id, record + HEADER_SIZE);
+        writeU32(record + 4, crc32(record + 8, size + 1));
+
+        appendBytes += recordSize;
+        if (retained) liveBySegment[appendSegment]++;
+        if (onDurable) durableTasks.push_back(std::move(onDurable));
+        appended++;
+
+        bool wake = buffer.size() == recordSize; // The flusher only needs a nudge for the first record of a group
+        lock.unlock();
+        if (wake) flushCV.notify_one();
+        return id;
+    }
+
+    // Keep a replayed record's segment. Only between replay() and start().
+    void retain(RecordId id)
+    {
+        liveBySegment[(uint32_t)(id >> 32)]++;
+    }
+
+    // The record is no longer needed for recovery
+    void discard(RecordId id)
+    {
+        std::lock_guard<std::mutex> lock(logMutex);
+        uint32_t segment = (uint32_t)(id >> 32);
+        auto live = liveBySegment.find(segment);
+        if (live == liveBySegment.end() || live->second == 0) return;
+        if (--live->second == 0)
+        {
+            collectDead();
+        }
+    }
+
+    // Waits until everything appended so far is durable
+    void sync()
+    {
+        std::unique_lock<std::mutex> lock(logMutex);
+        uint64_t target = appended;
+        flushCV.notify_one();
+        durableCV.wait(lock, [&] { return durable >= target; });
+    }
+
+private:
+    struct Switch
+    {
+        size_t offset;    // Where in the buffer the new segment starts
+        uint32_t segment;
+    };
+
+    const std::string directory;
+    const Options options;
+    std::vector<uint32_t> existing; // Segments found on disk, until start()
+
+    std::mutex logMutex;
+    std::condition_variable flushCV;
+    std::condition_variable spaceCV;
+    std::condition_variable durableCV;
+    std::vector<char> buffer;
+    std::vector<Switch> switches;
+    std::vector<Task> durableTasks;
+    std::vector<uint32_t> deadSegments;
+    std::map<uint32_t, size_t> liveBySegment; // Retained records per segment still on disk, oldest first
+    uint32_t appendSegment = 1;
+    uint32_t appendIndex = 0;
+    size_t appendBytes = 0;
+    uint64_t appended = 0;
+    uint64_t durable = 0;
+    bool stopping = false;
+    std::thread flusherThread;
+
+    // Flusher thread only
+    SegmentFile file;
+    uint32_t fileSegment = 0;
+
+    void flusherLoop()
+    {
+        std::vector<char> writing;
+        std::vector<Switch> writingSwitches;
+        std::vector<Task> tasks;
+        std::vector<uint32_t> dead;
+
+        std::unique_lock<std::mutex> lock(logMutex);
+        while (true)
+        {
+            flushCV.wait(lock, [this] { return !buffer.empty() || !deadSegments.empty() || stopping; });
+            if (buffer.empty() && deadSegments.empty() && stopping) break;
+
+            // Group commit: let more appends join this sync
+            if (!stopping && options.commitWindow.count() > 0 && buffer.size() < options.maxBuffered / 2)
+            {
+                flushCV.wait_for(lock, options.commitWindow, [this] { return stopping || buffer.size() >= options.maxBuffered / 2; });
+            }
+
+            writing.swap(buffer);
+            writingSwitches.swap(switches);
+            tasks.swap(durableTasks);
+            dead.swap(deadSegments);
+            uint64_t target = appended;
+            uint32_t segment = appendSegment - (uint32_t)writingSwitches.size(); // Where the first byte goes
+            lock.unlock();
+            spaceCV.notify_all();
+
+            size_t offset = 0;
+            for (const Switch& change : writingSwitches)
+            {
+                writeTo(segment, writing.data() + offset, change.offset - offset);
+                offset = change.offset;
+                segment = change.segment;
+            }
+            writeTo(segment, writing.data() + offset, writing.size() - offset);
+            if (!writing.empty() && !file.sync()) fail("sync");
+
+            for (Task& task : tasks) task();
+            tasks.clear();
+            for (uint32_t segmentNumber : dead)
+            {
+                if (segmentNumber == fileSegment) file.close();
+                std::error_code error;
+                std::filesystem::remove(segmentPath(segmentNumber), error);
+            }
+            dead.clear();
+            writing.clear();
+            writingSwitches.clear();
+
+            lock.lock();
+            durable = target;
+            durableCV.notify_all();
+        }
+    }
+
+    // Hand the oldest segments the log is done with to the flusher, up to the first one still needed
+    void collectDead()
+    {
+        while (!liveBySegment.empty())
+        {
+            auto oldest = liveBySegment.begin();
+            if (oldest->first >= appendSegment || oldest->second > 0) break;
+            deadSegments.push_back(oldest->first);
+            liveBySegment.erase(oldest);
+        }
+    }
+
+    void writeTo(uint32_t segment, const char* data, size_t size)
+    {
+        if (size == 0) return;
+        if (segment != fileSegment || !file.isOpen())
+        {
+            if (file.isOpen() && !file.sync()) fail("sync");
+            if (!file.open(segmentPath(segment))) fail("open");
+            fileSegment = segment;
+        }
+        if (!file.write(data, size)) fail("write");
+    }
+
+    [[noreturn]] void fail(const char* operation)
+    {
+        std::osyncstream(std::cerr) << "Write-ahead log " << operation << " failed in " << directory << std::endl;
+        std::abort();
+    }
+
+    std::string segmentPath(uint32_t segment) const
+    {
+        char name[32];
+        std::snprintf(name, sizeof(name), "wal-%08u.log", segment);
+        return (std::filesystem::path(directory) / name).string();
+    }
+
+    static bool parseSegmentName(const std::string& name, uint32_t& segment)
+    {
+        unsigned value;
+        char extension[8] = {};
+        if (name.size() != 16 || std::sscanf(name.c_str(), "wal-%8u.%3s", &value, extension) != 2) return false;
+        if (std::strcmp(extension, "log") != 0) return false;
+        segment = value;
+        return true;
+    }
+
+    static uint32_t readU32(const char* bytes)
+    {
+        uint32_t value;
+        std::memcpy(&value, bytes, sizeof(value));
+        return value;
+    }
+
+    static void writeU32(char* bytes, uint32_t value)
+    {
+        std::memcpy(bytes, &value, sizeof(value));
+    }
+
+    // CRC-32 (IEEE), table driven
+    static uint32_t crc32(const char* data, size_t size)
+    {
+        static const auto table = [] {
+            std::array<uint32_t, 256> entries{};
+            for (uint32_t i = 0; i < 256; i++)
+            {
+                uint32_t value = i;
+                for (int bit = 0; bit < 8; bit++) value = (value & 1) ? 0xEDB88320u ^ (value >> 1) : value >> 1;
+                entries[i] = value;
+            }
+            return entries;
+        }();
+
+        uint32_t crc = 0xFFFFFFFFu;
+        for (size_t i = 0; i < size; i++)
+        {
+            crc = table[(crc ^ (uint8_t)data[i]) & 0xFF] ^ (crc >> 8);
+        }
+        return ~crc;
+    }
+};
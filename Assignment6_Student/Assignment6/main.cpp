@@ -1,9 +1,19 @@
 #include "Assignment6a.cpp"
 #include "Assignment6b.cpp"
+#include "SchedulerBenchmark.cpp"
+#include "LogBenchmark.cpp"
 
 using namespace std;
 
-int main() {
+int main(int argc, char* argv[]) {
+   if (argc > 1 && std::string(argv[1]) == "--bench") {
+      SchedulerBenchmark::Execute();
+      return 0;
+   }
+   if (argc > 1 && std::string(argv[1]) == "--bench-log") {
+      LogBenchmark::Execute();
+      return 0;
+   }
    std::cout << "=========Assignment6a=========" << std::endl;
    Assignment6a::Execute();
    std::cout << "=========Assignment6b=========" << std::endl;
@@ -0,0 +1,378 @@
+// Initialize WinSock2
+#define WIN32_LEAN_AND_MEAN // Reduce Windows header bloat
+#include <winsock2.h>       // Core WinSock functionality
+#include <ws2tcpip.h>       // TCP/IP specific functions
+
+#pragma comment(lib, "Ws2_32.lib") // Link with Ws2_32.lib
+
+// Note: winsock2.h must come before windows.h if used
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+
+#include "Socket.h"
+#include "IPEndpoint.h"
+#include "WSASession.h"
+
+// Simulated chat client
+/*
+* -Blocking connect and name handshake, non-blocking afterwards
+* -Owned by one swarm thread, which polls it together with the other bots
+*/
+class Bot : public TCPSocket
+{
+public:
+    std::string pending;  // Received bytes that don't form a whole message yet
+    std::string outgoing; // Rest of a message the socket only took part of
+
+    void connect(const IPv4Endpoint& endpoint)
+    {
+        if (::connect(sock, endpoint.as_sockaddr(), endpoint.size()) == SOCKET_ERROR)
+        {
+            throw std::runtime_error("Connect failed: " +
+                std::to_string(WSAGetLastError()));
+        }
+
+        BOOL noDelay = TRUE; // Measure the server, not Nagle
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&noDelay), sizeof(noDelay));
+    }
+
+    void setNonBlocking()
+    {
+        unsigned long mode = 1;
+        if (ioctlsocket(sock, FIONBIO, &mode) == SOCKET_ERROR)
+        {
+            throw std::runtime_error("Failed to set non-blocking mode: " +
+                std::to_string(WSAGetLastError()));
+        }
+    }
+
+    // Send a null terminated message, whatever the socket doesn't take now goes out with flush()
+    // Returns false, dropping the message, while the previous one is still not fully sent
+    bool post(const std::string& message)
+    {
+        if (!flush())
+        {
+            return false;
+        }
+        outgoing.assign(message.c_str(), message.size() + 1);
+        flush();
+        return true;
+    }
+
+    // Send what is left of the last message, true once all of it has gone
+    bool flush()
+    {
+        while (!outgoing.empty())
+        {
+            int bytes = ::send(sock, outgoing.data(), (int)outgoing.size(), 0);
+            if (bytes <= 0)
+            {
+                return false; // Socket buffer is full
+            }
+            outgoing.erase(0, bytes);
+        }
+        return true;
+    }
+
+    SOCKET handle() const { return sock; }
+};
+
+struct BenchConfig
+{
+    const char* ip = "127.0.0.1";
+    unsigned short port = 8080;
+    std::vector<size_t> clientCounts = { 10, 100, 500, 1000 };
+    size_t threads = 4;
+    double rate = 1.0;   // Messages per second per client
+    int warmupSeconds = 2;
+    int measureSeconds = 10;
+};
+
+struct BenchResult
+{
+    size_t clients = 0;
+    uint64_t sent = 0;
+    uint64_t delivered = 0;
+    uint64_t skipped = 0;   // Messages dropped because the previous one was still being sent
+    uint64_t closed = 0;    // Bots the server hung up on, they take no further part
+    std::vector<uint32_t> latencies; // Microseconds
+};
+
+// Chat load test
+/*
+* -Opens N bots from a few threads, each thread multiplexing its bots with WSAPoll
+* -Every bot joins the same fresh room and sends "bench <timestamp>" at a fixed rate
+* -Receivers compute the end to end fan-out latency from the embedded timestamp
+* -Runs once per client count and prints delivered messages per second and percentiles
+* -A bot whose connection drops leaves the poll set and is counted as closed
+*/
+class ChatBench
+{
+public:
+    explicit ChatBench(const BenchConfig& config)
+        : config(config)
+    {
+    }
+
+    void run()
+    {
+        std::cout << std::left
+            << std::setw(9) << "clients" << std::setw(12) << "sent/s" << std::setw(14) << "delivered/s"
+            << std::setw(10) << "fan-out" << std::setw(10) << "p50 ms" << std::setw(10) << "p90 ms"
+            << std::setw(10) << "p99 ms" << std::setw(10) << "p99.9 ms" << std::setw(10) << "max ms"
+            << std::setw(10) << "skipped" << "closed" << std::endl;
+
+        for (size_t clients : config.clientCounts)
+        {
+            try
+            {
+                report(run_step(clients));
+            }
+            catch (const std::exception& e)
+            {
+                std::cerr << "Step with " << clients << " clients failed: " << e.what() << std::endl;
+                break;
+            }
+        }
+    }
+
+private:
+    enum class Phase { CONNECTING, WARMUP, MEASURE, STOP };
+
+    BenchConfig config;
+    std::atomic<Phase> phase{ Phase::CONNECTING };
+    std::atomic<size_t> connected{ 0 };
+
+    static int64_t now_us()
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    BenchResult run_step(size_t clients)
+    {
+        // A fresh room per step so nobody is replayed old history
+        std::string room = "bench" + std::to_string(clients) + "_" + std::to_string(now_us());
+
+        phase = Phase::CONNECTING;
+        connected = 0;
+
+        size_t threadCount = std::max<size_t>(1, std::min(config.threads, clients));
+        std::vector<BenchResult> results(threadCount);
+        std::vector<std::thread> swarm;
+        std::atomic<bool> failed{ false };
+        for (size_t t = 0; t < threadCount; t++)
+        {
+            size_t first = clients * t / threadCount;
+            size_t last = clients * (t + 1) / threadCount;
+            swarm.emplace_back([this, &results, &failed, t, first, last, room] {
+                try
+                {
+                    swarm_thread(first, last, room, results[t]);
+                }
+                catch (const std::exception& e)
+                {
+                    std::cerr << "Swarm thread " << t << ": " << e.what() << std::endl;
+                    failed = true;
+                    connected += last - first; // Don't hold up the others
+                }
+            });
+        }
+
+        while (connected < clients)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+
+        phase = Phase::WARMUP;
+        std::this_thread::sleep_for(std::chrono::seconds(config.warmupSeconds));
+        phase = Phase::MEASURE;
+        std::this_thread::sleep_for(std::chrono::seconds(config.measureSeconds));
+        phase = Phase::STOP;
+
+        for (std::thread& t : swarm)
+        {
+            t.join();
+        }
+        if (failed)
+        {
+            throw std::runtime_error("not every bot could connect");
+        }
+
+        BenchResult total;
+        total.clients = clients;
+        for (BenchResult& r : results)
+        {
+            total.sent += r.sent;
+            total.delivered += r.delivered;
+            total.skipped += r.skipped;
+            total.closed += r.closed;
+            total.latencies.insert(total.latencies.end(), r.latencies.begin(), r.latencies.end());
+        }
+        return total;
+    }
+
+    void swarm_thread(size_t first, size_t last, const std::string& room, BenchResult& result)
+    {
+        IPv4Endpoint endpoint(config.ip, config.port);
+
+        std::vector<std::unique_ptr<Bot>> bots;
+        std::vector<WSAPOLLFD> fds;
+        for (size_t i = first; i < last; i++)
+        {
+            auto bot = std::make_unique<Bot>();
+            bot->connect(endpoint);
+            bot->post("bot" + std::to_string(i));
+            bot->post("/join " + room);
+            bot->setNonBlocking();
+
+            WSAPOLLFD fd = {};
+            fd.fd = bot->handle();
+            fd.events = POLLRDNORM;
+            fds.push_back(fd);
+            bots.push_back(std::move(bot));
+            connected++;
+        }
+
+        // Spread the bots' send times evenly over one period
+        const int64_t period = (int64_t)(1000000.0 / config.rate);
+        std::vector<int64_t> nextSend(bots.size());
+        int64_t start = now_us();
+        for (size_t i = 0; i < bots.size(); i++)
+        {
+            nextSend[i] = start + period * (int64_t)i / (int64_t)bots.size();
+        }
+
+        while (phase != Phase::STOP)
+        {
+            if (bots.empty()) // All of them were hung up on, wait for the step to end
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                continue;
+            }
+
+            bool sending = phase == Phase::WARMUP || phase == Phase::MEASURE;
+            bool measuring = phase == Phase::MEASURE;
+
+            int64_t now = now_us();
+            int64_t wait = 10000;
+            for (size_t i = 0; sending && i < bots.size(); i++)
+            {
+                if (nextSend[i] <= now)
+                {
+                    if (bots[i]->post("bench " + std::to_string(now_us())))
+                    {
+                        result.sent += measuring;
+                    }
+                    else
+                    {
+                        result.skipped += measuring;
+                    }
+                    nextSend[i] += period;
+                    if (nextSend[i] < now) // Fell behind, don't burst to catch up
+                    {
+                        nextSend[i] = now + period;
+                    }
+                }
+                wait = std::min(wait, nextSend[i] - now);
+            }
+
+            for (size_t i = 0; i < fds.size(); i++) // Finish partial sends as soon as there is room
+            {
+                fds[i].events = POLLRDNORM | (bots[i]->outgoing.empty() ? 0 : POLLWRNORM);
+            }
+
+            int ready = WSAPoll(fds.data(), (ULONG)fds.size(), (int)std::max<int64_t>(0, wait / 1000));
+            if (ready <= 0)
+            {
+                continue;
+            }
+
+            // Walk backwards so dropping a bot doesn't shift the ones still to be handled
+            for (size_t i = fds.size(); i-- > 0;)
+            {
+                if (fds[i].revents & POLLWRNORM)
+                {
+                    bots[i]->flush();
+                }
+                if ((fds[i].revents & (POLLRDNORM | POLLHUP | POLLERR)) && !receive(*bots[i], measuring, result))
+                {
+                    result.closed++;
+                    bots.erase(bots.begin() + i);
+                    fds.erase(fds.begin() + i);
+                    nextSend.erase(nextSend.begin() + i);
+                }
+            }
+        }
+    }
+
+    // Returns false once the connection is gone, after handling whatever arrived before that
+    bool receive(Bot& bot, bool measuring, BenchResult& result)
+    {
+        char buffer[16384];
+        int bytes;
+        while ((bytes = recv(bot.handle(), buffer, sizeof(buffer), 0)) > 0)
+        {
+            bot.pending.append(buffer, bytes);
+        }
+        bool open = bytes == SOCKET_ERROR && WSAGetLastError() == WSAEWOULDBLOCK;
+
+        int64_t now = now_us();
+        size_t start = 0;
+        size_t end;
+        while ((end = bot.pending.find('\0', start)) != std::string::npos)
+        {
+            // Messages arrive as "#<seq> <name>: bench <timestamp>"
+            const char* message = bot.pending.c_str() + start;
+            const char* stamp = strstr(message, ": bench ");
+            if (stamp != nullptr && measuring)
+            {
+                int64_t sentAt = std::strtoll(stamp + 8, nullptr, 10);
+                result.delivered++;
+                result.latencies.push_back((uint32_t)std::max<int64_t>(0, now - sentAt));
+            }
+            start = end + 1;
+        }
+        bot.pending.erase(0, start);
+        return open;
+    }
+
+    void report(BenchResult result)
+    {
+        std::sort(result.latencies.begin(), result.latencies.end());
+        auto percentile = [&result](double p) {
+            if (result.latencies.empty())
+            {
+                return 0.0;
+            }
+            size_t index = std::min(result.latencies.size() - 1, (size_t)(p * result.latencies.size()));
+            return result.latencies[index] / 1000.0;
+        };
+
+        double seconds = config.measureSeconds;
+        double fanout = result.sent ? (double)result.delivered / result.sent : 0.0;
+
+        std::cout << std::left << std::fixed << std::setprecision(2)
+            << std::setw(9) << result.clients
+            << std::setw(12) << result.sent / seconds
+            << std::setw(14) << result.delivered / seconds
+            << std::setw(10) << fanout
+            << std::setw(10) << percentile(0.50)
+            << std::setw(10) << percentile(0.90)
+            << std::setw(10) << percentile(0.99)
+            << std::setw(10) << percentile(0.999)
+            << std::setw(10) << percentile(1.0)
+            << std::setw(10) << result.skipped << result.closed << std::endl;
+    }
+};
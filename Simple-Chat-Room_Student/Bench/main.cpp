@@ -0,0 +1,42 @@
+#include "ChatBench.cpp"
+
+// Usage: ChatBench [--ip 127.0.0.1] [--port 8080] [--clients 10,100,500,1000]
+//                  [--threads 4] [--rate 1] [--warmup 2] [--seconds 10]
+int main(int argc, char* argv[]) {
+    BenchConfig config;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string option = argv[i];
+        std::string value = argv[i + 1];
+        if (option == "--ip") config.ip = argv[i + 1];
+        else if (option == "--port") config.port = (unsigned short)std::stoi(value);
+        else if (option == "--threads") config.threads = std::stoul(value);
+        else if (option == "--rate") config.rate = std::stod(value);
+        else if (option == "--warmup") config.warmupSeconds = std::stoi(value);
+        else if (option == "--seconds") config.measureSeconds = std::stoi(value);
+        else if (option == "--clients") {
+            config.clientCounts.clear();
+            size_t start = 0;
+            while (start < value.size()) {
+                size_t end = value.find(',', start);
+                if (end == std::string::npos) end = value.size();
+                config.clientCounts.push_back(std::stoul(value.substr(start, end - start)));
+                start = end + 1;
+            }
+        }
+        else {
+            std::cerr << "Unknown option: " << option << std::endl;
+            return 1;
+        }
+    }
+
+    try {
+        WSASession session; // Initialize WinSock
+        ChatBench bench(config);
+        bench.run();
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -14,44 +14,12 @@
 #include <condition_variable>
 #include <atomic>
 #include <chrono>
+#include <memory>
 
 #include "Socket.h"
 #include "IPEndpoint.h"
 #include "WSASession.h"
-
-// TCP Client
-/*
-* -Singly threaded
-* -Blocking
-*/
-class TCPClient : public TCPSocket {
-protected:
-    void connect(const IPv4Endpoint& endpoint) { // Connect to an endpoint
-        if (::connect(sock, endpoint.as_sockaddr(), endpoint.size())
-            == SOCKET_ERROR) {
-            throw std::runtime_error("Connect failed: " +
-                std::to_string(WSAGetLastError()));
-        }
-    }
-
-    int send(const char* data, int length) { // Send data
-        int bytes = ::send(sock, data, length, 0);
-        if (bytes == SOCKET_ERROR) {
-            throw std::runtime_error("Send failed: " +
-                std::to_string(WSAGetLastError()));
-        }
-        return bytes;
-    }
-
-    int receive(char* buffer, int length) { // Receive data
-        int bytes = recv(sock, buffer, length, 0);
-        if (bytes == SOCKET_ERROR) {
-            throw std::runtime_error("Receive failed: " +
-                std::to_string(WSAGetLastError()));
-        }
-        return bytes;
-    }
-};
+#include "ChatClientRuntime.cpp"
 
 // Math Client
 /*
@@ -64,85 +32,175 @@ protected:
 // This client WILL NOT receive any other client's math problems or results
 // IMPLEMENT HERE
 
-class ChatClient : public TCPClient
+// Interactive chat client
+/*
+* -Socket I/O runs on one ChatClientRuntime loop, which sleeps in WSAPoll until there is work
+* -Console input can't be polled with WSAPoll, so a reader thread posts each line to the session
+* -A dropped connection is resumed in the background, the server only sends what was missed
+* -The client owns its threads and joins them before start() returns, nothing outlives it
+*/
+class ChatClient
 {
 public:
-    std::thread sendThread;
-    std::thread receiveThread;
-
-    bool active = true;
-
-
     void start(const char* ip, unsigned short port)
     {
-        IPv4Endpoint endpoint(ip, port);
-        connect(endpoint);
-
         std::string input;
 
         std::cout << "Enter Name: ";
         std::getline(std::cin, input);
 
-        send(input.c_str(), (int)input.length());
+        this->ip = ip;
+        this->port = port;
+        name = input;
+        set_session(connect({}));
 
         sendThread = std::thread([this] { this->message_send(); });
-        sendThread.detach();
 
-        receiveThread = std::thread([this] {this->message_read(); });
-        receiveThread.detach();
+        try
+        {
+            runtime.run(); // Only stops once the send thread is done with the console
+        }
+        catch (const std::exception& e)
+        {
+            std::cout << "\n" << e.what() << ", press Enter to exit." << std::endl;
+            quit();
+            join_threads();
+            throw;
+        }
+        join_threads();
+    }
+
+private:
+    ChatClientRuntime runtime;
+    std::mutex session_mutex;
+    std::shared_ptr<ChatSession> session;
+    std::thread sendThread;
+    std::thread reconnectThread; // Only started and joined by the loop thread
+    std::atomic<bool> quitting{ false };
+    std::mutex quit_mutex;
+    std::condition_variable quit_cv; // Cuts a reconnect's backoff short
+
+    std::string ip;
+    unsigned short port = 0;
+    std::string name;
+
+    std::shared_ptr<ChatSession> connect(ResumePoint resume)
+    {
+        return runtime.connect(ip.c_str(), port, name,
+            [this](ChatSession&, const std::string& message) { this->message_read(message); },
+            [this](ChatSession& lost) { this->disconnected(lost); },
+            std::move(resume));
+    }
+
+    std::shared_ptr<ChatSession> get_session()
+    {
+        std::lock_guard<std::mutex> lock(session_mutex);
+        return session;
+    }
+
+    void set_session(std::shared_ptr<ChatSession> current)
+    {
+        std::lock_guard<std::mutex> lock(session_mutex);
+        session = std::move(current);
+    }
+
+    void quit()
+    {
+        {
+            std::lock_guard<std::mutex> lock(quit_mutex);
+            quitting = true;
+        }
+        quit_cv.notify_all();
+    }
 
-        while (active)
+    void join_threads()
+    {
+        sendThread.join();
+        if (reconnectThread.joinable())
         {
+            reconnectThread.join();
+        }
+    }
 
+    // Runs on the loop thread, so the (blocking) reconnect happens elsewhere
+    void disconnected(ChatSession& lost)
+    {
+        if (quitting)
+        {
+            runtime.stop();
+            return;
         }
+        if (reconnectThread.joinable()) // The last reconnect is done, it handed over the session we just lost
+        {
+            reconnectThread.join();
+        }
+        ResumePoint resume = lost.resume_point();
+        reconnectThread = std::thread([this, resume] { this->reconnect(resume); });
     }
 
+    // Retry with backoff until the server is back
+    void reconnect(ResumePoint resume)
+    {
+        message_read("Connection lost, reconnecting...");
+        std::chrono::milliseconds delay(250);
+        while (true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(quit_mutex);
+                if (quit_cv.wait_for(lock, delay, [this] { return quitting.load(); }))
+                {
+                    return;
+                }
+            }
+            try
+            {
+                set_session(connect(resume));
+                return;
+            }
+            catch (const std::exception&)
+            {
+                delay = std::min(delay * 2, std::chrono::milliseconds(5000));
+            }
+        }
+    }
 
     void message_send()
     {
-        while (active)
+        while (true)
         {
             std::string input;
 
-            std::cout << "You: ";
-            std::getline(std::cin, input);
+            std::cout << "You: " << std::flush;
+            if (!std::getline(std::cin, input))
+            {
+                break;
+            }
 
             while (input.length() >= 1024)
             {
                 std::cout << "Message Too long. Shorter then 1024 characters." << std::endl;
-                std::cout << "You: ";
+                std::cout << "You: " << std::flush;
                 std::getline(std::cin, input);
             }
 
             if (input == "quit")
             {
-                active = false;
                 break;
             }
-            input.push_back('\0');
 
-            send(input.c_str(), (int)input.length());
+            if (!get_session()->post(input))
+            {
+                std::cout << "Not connected, message dropped." << std::endl;
+            }
         }
+        quit();
+        runtime.stop();
     }
 
-    void message_read()
+    void message_read(const std::string& message)
     {
-        while (active)
-        {
-            char buffer[1024];
-            int bytes = receive(buffer, sizeof(buffer) - 1);
-            if (bytes <= 0)
-            {
-                break;
-            }
-
-            buffer[bytes] = '\0';
-
-            std::cout << "\x1b[2K" << "\r";
-            std::cout << buffer << std::endl;
-
-            std::cout << "You: ";
-
-        }
+        std::cout << "\x1b[2K" << "\r";
+        std::cout << message << std::endl;
+        std::cout << "You: " << std::flush;
     }
-};
\ No newline at end of file
+};
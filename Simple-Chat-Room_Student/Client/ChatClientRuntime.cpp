@@ -0,0 +1,399 @@
+#pragma once
+
+// Initialize WinSock2
+#define WIN32_LEAN_AND_MEAN // Reduce Windows header bloat
+#include <winsock2.h>       // Core WinSock functionality
+#include <ws2tcpip.h>       // TCP/IP specific functions
+
+#pragma comment(lib, "Ws2_32.lib") // Link with Ws2_32.lib
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <algorithm>
+#include <sstream>
+#include <charconv>
+#include <cstdint>
+
+#include "Socket.h"
+#include "IPEndpoint.h"
+#include "WSASession.h"
+
+// Wakes the runtime's poll loop from other threads
+/*
+* -A UDP socket bound to loopback that sends itself a byte, WSAPoll can't wait on anything but sockets
+* -Only one wake is in flight at a time
+*/
+class Waker : public UDPSocket
+{
+public:
+    Waker()
+    {
+        IPv4Endpoint endpoint("127.0.0.1", 0);
+        if (::bind(sock, endpoint.as_sockaddr(), endpoint.size()) == SOCKET_ERROR)
+        {
+            throw std::runtime_error("Waker bind failed: " +
+                std::to_string(WSAGetLastError()));
+        }
+
+        int length = sizeof(address);
+        getsockname(sock, reinterpret_cast<sockaddr*>(&address), &length);
+
+        unsigned long mode = 1;
+        ioctlsocket(sock, FIONBIO, &mode);
+    }
+
+    void wake()
+    {
+        if (!pending.exchange(true))
+        {
+            char byte = 0;
+            sendto(sock, &byte, 1, 0, reinterpret_cast<const sockaddr*>(&address), sizeof(address));
+        }
+    }
+
+    // Called by the loop once it is awake, before it looks for work
+    void drain()
+    {
+        pending = false;
+        char buffer[64];
+        while (recv(sock, buffer, sizeof(buffer), 0) > 0)
+        {
+        }
+    }
+
+    SOCKET handle() const { return sock; }
+
+private:
+    sockaddr_in address = {};
+    std::atomic<bool> pending{ false };
+};
+
+// What a reconnect needs to pick up where a session left off
+struct ResumePoint
+{
+    std::string token; // Empty until the server has issued one
+    std::string name;  // The name the server gave us
+    std::string room;
+    uint64_t last_sequence = 0;
+};
+
+// One chat connection driven by a ChatClientRuntime
+/*
+* -post() and close() can be called from any thread and never block on the network
+* -Callbacks run on the runtime's loop thread
+* -Keeps track of where to resume from: control frames ("!...") are consumed here and
+*  the "#<seq> " in front of chat messages is stripped before the message handler sees them
+*/
+class ChatSession : public TCPSocket
+{
+public:
+    typedef std::function<void(ChatSession&, const std::string&)> MessageHandler;
+    typedef std::function<void(ChatSession&)> DisconnectHandler;
+
+    const std::string name;
+
+    ChatSession(const std::string& name, Waker& waker, MessageHandler on_message, DisconnectHandler on_disconnect,
+        ResumePoint resume = {})
+        : name(name), waker(waker), on_message(std::move(on_message)), on_disconnect(std::move(on_disconnect)),
+        point(std::move(resume))
+    {
+        if (point.name.empty())
+        {
+            point.name = name;
+        }
+    }
+
+    // Queue a message for the server. Returns false once the session is closed.
+    bool post(const std::string& message)
+    {
+        if (!open)
+        {
+            return false;
+        }
+        {
+            std::lock_guard<std::mutex> lock(outbox_mutex);
+            outbox.push_back(message);
+        }
+        waker.wake();
+        return true;
+    }
+
+    void close()
+    {
+        closing = true;
+        waker.wake();
+    }
+
+    bool connected() const
+    {
+        return open;
+    }
+
+    // Read from callbacks, or once the session has disconnected
+    const ResumePoint& resume_point() const
+    {
+        return point;
+    }
+
+private:
+    friend class ChatClientRuntime;
+
+    Waker& waker;
+    MessageHandler on_message;
+    DisconnectHandler on_disconnect;
+
+    std::mutex outbox_mutex;
+    std::vector<std::string> outbox; // Posted, not yet picked up by the loop
+    std::string sending;             // Framed bytes the socket hasn't taken yet
+    std::string received;            // Bytes that don't form a whole message yet
+    std::atomic<bool> open{ true };
+    std::atomic<bool> closing{ false };
+    ResumePoint point;        // Only touched by the loop thread while connected
+    bool catching_up = false; // Between "!joining" and "!joined" when resuming
+
+    void connect(const IPv4Endpoint& endpoint)
+    {
+        if (::connect(sock, endpoint.as_sockaddr(), endpoint.size()) == SOCKET_ERROR)
+        {
+            throw std::runtime_error("Connect failed: " +
+                std::to_string(WSAGetLastError()));
+        }
+
+        unsigned long mode = 1;
+        ioctlsocket(sock, FIONBIO, &mode);
+
+        // Name handshake, or ask for what we missed
+        std::string handshake = name;
+        if (!point.token.empty())
+        {
+            handshake = "/resume " + point.token + " " + std::to_string(point.last_sequence) + " " + point.name;
+        }
+        sending.assign(handshake.c_str(), handshake.size() + 1);
+    }
+
+    // Move posted messages into the send buffer and write as much as the socket takes
+    bool flush()
+    {
+        {
+            std::lock_guard<std::mutex> lock(outbox_mutex);
+            for (const std::string& message : outbox)
+            {
+                sending.append(message.c_str(), message.size() + 1);
+            }
+            outbox.clear();
+        }
+
+        while (!sending.empty())
+        {
+            int bytes = ::send(sock, sending.data(), (int)sending.size(), 0);
+            if (bytes == SOCKET_ERROR)
+            {
+                return WSAGetLastError() == WSAEWOULDBLOCK;
+            }
+            sending.erase(0, bytes);
+        }
+        return true;
+    }
+
+    // Read everything available and hand each whole message to the callback
+    bool read()
+    {
+        char buffer[4096];
+        while (true)
+        {
+            int bytes = recv(sock, buffer, sizeof(buffer), 0);
+            if (bytes == 0)
+            {
+                return false;
+            }
+            if (bytes == SOCKET_ERROR)
+            {
+                if (WSAGetLastError() != WSAEWOULDBLOCK)
+                {
+                    return false;
+                }
+                break;
+            }
+            received.append(buffer, bytes);
+        }
+
+        size_t start = 0;
+        size_t end;
+        while ((end = received.find('\0', start)) != std::string::npos)
+        {
+            if (end > start)
+            {
+                receive_frame(received.substr(start, end - start));
+            }
+            start = end + 1;
+        }
+        received.erase(0, start);
+        return true;
+    }
+
+    void receive_frame(std::string message)
+    {
+        std::istringstream fields(message);
+        std::string control;
+        if (message[0] == '!' && fields >> control)
+        {
+            if (control == "!session")
+            {
+                fields >> point.token >> point.name;
+            }
+            else if (control == "!joining") // Sequence numbers start over in the new room
+            {
+                fields >> point.room >> point.last_sequence;
+                catching_up = point.last_sequence > 0;
+            }
+            else if (control == "!joined")
+            {
+                fields >> point.room >> point.last_sequence;
+                catching_up = false;
+            }
+            else if (control == "!gap" && on_message) // The room no longer has everything we missed
+            {
+                uint64_t first = 0;
+                fields >> first;
+                on_message(*this, "Messages from #" + std::to_string(point.last_sequence + 1) + " to #" +
+                    std::to_string(first - 1) + " are no longer available.");
+            }
+            return;
+        }
+
+        if (message[0] == '#')
+        {
+            const char* end = message.data() + message.size();
+            uint64_t sequence = 0;
+            auto parsed = std::from_chars(message.data() + 1, end, sequence);
+            if (parsed.ec == std::errc() && parsed.ptr < end && *parsed.ptr == ' ')
+            {
+                point.last_sequence = std::max(point.last_sequence, sequence);
+                message.erase(0, parsed.ptr - message.data() + 1);
+
+                // What we said while disconnected comes back in the catch up, it is already on screen
+                if (catching_up && message.compare(0, point.name.size() + 2, point.name + ": ") == 0)
+                {
+                    return;
+                }
+            }
+        }
+
+        if (on_message)
+        {
+            on_message(*this, message);
+        }
+    }
+};
+
+// Runs any number of chat sessions on one thread
+/*
+* -One WSAPoll over every session socket plus the waker, no busy waiting
+* -Sockets only ask for write readiness while they have unsent bytes
+* -Hundreds of idle sessions cost one sleeping thread
+*/
+class ChatClientRuntime
+{
+public:
+    // Connects (blocking) and hands the session to the loop, which sends the name first
+    // Passing the resume point of a disconnected session picks up where it left off, if the server still allows it
+    std::shared_ptr<ChatSession> connect(const char* ip, unsigned short port, const std::string& name,
+        ChatSession::MessageHandler on_message, ChatSession::DisconnectHandler on_disconnect = nullptr,
+        ResumePoint resume = {})
+    {
+        auto session = std::make_shared<ChatSession>(name, waker, std::move(on_message), std::move(on_disconnect),
+            std::move(resume));
+        session->connect(IPv4Endpoint(ip, port));
+        {
+            std::lock_guard<std::mutex> lock(added_mutex);
+            added.push_back(session);
+        }
+        waker.wake();
+        return session;
+    }
+
+    // Run the loop on the calling thread until stop()
+    void run()
+    {
+        std::vector<WSAPOLLFD> fds;
+        while (running)
+        {
+            waker.drain();
+            {
+                std::lock_guard<std::mutex> lock(added_mutex);
+                sessions.insert(sessions.end(), added.begin(), added.end());
+                added.clear();
+            }
+
+            for (size_t i = 0; i < sessions.size(); i++)
+            {
+                if (sessions[i]->closing || !sessions[i]->flush())
+                {
+                    disconnect(i--);
+                }
+            }
+
+            fds.resize(sessions.size() + 1);
+            fds[0].fd = waker.handle();
+            fds[0].events = POLLRDNORM;
+            fds[0].revents = 0;
+            for (size_t i = 0; i < sessions.size(); i++)
+            {
+                fds[i + 1].fd = sessions[i]->sock;
+                fds[i + 1].events = POLLRDNORM | (sessions[i]->sending.empty() ? 0 : POLLWRNORM);
+                fds[i + 1].revents = 0;
+            }
+
+            if (WSAPoll(fds.data(), (ULONG)fds.size(), -1) == SOCKET_ERROR)
+            {
+                throw std::runtime_error("WSAPoll failed: " +
+                    std::to_string(WSAGetLastError()));
+            }
+
+            // Walk backwards so a disconnect doesn't shift the sessions still to be handled
+            for (size_t i = sessions.size(); i-- > 0;)
+            {
+                short events = fds[i + 1].revents;
+                if (events & (POLLRDNORM | POLLHUP | POLLERR))
+                {
+                    if (!sessions[i]->read())
+                    {
+                        disconnect(i);
+                    }
+                }
+            }
+        }
+    }
+
+    // Can be called from any thread, including from a callback
+    void stop()
+    {
+        running = false;
+        waker.wake();
+    }
+
+private:
+    Waker waker;
+    std::atomic<bool> running{ true };
+
+    std::mutex added_mutex;
+    std::vector<std::shared_ptr<ChatSession>> added;    // Connected but not yet seen by the loop
+    std::vector<std::shared_ptr<ChatSession>> sessions; // Only touched by the loop thread
+
+    void disconnect(size_t index)
+    {
+        std::shared_ptr<ChatSession> session = sessions[index];
+        sessions.erase(sessions.begin() + index);
+
+        session->open = false;
+        shutdown(session->sock, SD_BOTH); // The socket itself closes with the last reference
+        if (session->on_disconnect)
+        {
+            session->on_disconnect(*session);
+        }
+    }
+};
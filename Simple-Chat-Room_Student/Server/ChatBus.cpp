@@ -0,0 +1,290 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <chrono>
+#include <functional>
+#include <algorithm>
+
+#include "Socket.h"
+#include "IPEndpoint.h"
+#include "Connection.cpp"
+
+// Bus frames reuse the chat framing: "<kind><room>\0<message>\0"
+// kind is MESSAGE (recorded in history) or NOTICE (joins, leaves)
+namespace Bus
+{
+    const char MESSAGE = 'M';
+    const char NOTICE = 'N';
+
+    // Links carry other servers' traffic, names and all, so they may read longer frames than a client
+    const size_t MAX_FRAME = 64 * 1024;
+
+    inline std::string frame(char kind, const std::string& room, const std::string& message)
+    {
+        std::string frame(1, kind);
+        frame += room;
+        frame.push_back('\0');
+        frame += message;
+        return frame; // send_message adds the final terminator
+    }
+
+    // Read one frame, false once the peer has gone
+    inline bool receive(Connection& link, char& kind, std::string& room, std::string& message)
+    {
+        std::string header;
+        if (!link.receive_message(header) || header.empty() || !link.receive_message(message))
+        {
+            return false;
+        }
+        kind = header[0];
+        room = header.substr(1);
+        return true;
+    }
+}
+
+// Local pub/sub broker that federates ChatServer processes
+/*
+* -Listens on loopback only, every ChatServer process keeps one link to it
+* -A frame published by one link is forwarded to every other link, never back
+* -Each link has a reading thread, like the chat server's clients, and a writing thread with its own queue,
+*  so a link that is slow to read only holds up itself
+* -A link more than MAX_QUEUED frames behind is dropped, its server reconnects
+*/
+class BusBroker : public TCPSocket
+{
+public:
+    void start(unsigned short port)
+    {
+        IPv4Endpoint endpoint("127.0.0.1", port);
+        if (::bind(sock, endpoint.as_sockaddr(), endpoint.size()) == SOCKET_ERROR)
+        {
+            throw std::runtime_error("Bus bind failed: " +
+                std::to_string(WSAGetLastError()));
+        }
+        if (::listen(sock, SOMAXCONN) == SOCKET_ERROR)
+        {
+            throw std::runtime_error("Bus listen failed: " +
+                std::to_string(WSAGetLastError()));
+        }
+
+        std::cout << "Bus broker listening on port: " << port << std::endl;
+
+        acceptThread = std::thread([this] { this->accept_links(); });
+        acceptThread.detach();
+    }
+
+private:
+    static const size_t MAX_QUEUED = 4096; // Frames waiting for one link
+
+    struct Link
+    {
+        std::shared_ptr<Connection> connection;
+        std::mutex mutex;
+        std::condition_variable ready;
+        std::deque<std::shared_ptr<const std::string>> queue;
+        bool closed = false;
+    };
+    typedef std::vector<std::shared_ptr<Link>> LinkList;
+
+    std::thread acceptThread;
+    std::mutex links_mutex;
+    std::shared_ptr<const LinkList> links = std::make_shared<const LinkList>(); // Replaced, never changed, on connect and disconnect
+
+    void accept_links()
+    {
+        while (true)
+        {
+            SOCKET client = ::accept(sock, nullptr, nullptr);
+            if (client == INVALID_SOCKET)
+            {
+                std::cerr << "Bus accept failed: " << WSAGetLastError() << std::endl;
+                continue;
+            }
+
+            auto link = std::make_shared<Link>();
+            link->connection = std::make_shared<Connection>(client);
+            link->connection->max_message = Bus::MAX_FRAME;
+            {
+                std::lock_guard<std::mutex> lock(links_mutex);
+                auto updated = std::make_shared<LinkList>(*links);
+                updated->push_back(link);
+                links = std::move(updated);
+            }
+            std::thread([this, link] { this->forward(link); }).detach();
+            std::thread([link] { write_out(link); }).detach();
+        }
+    }
+
+    void forward(std::shared_ptr<Link> link)
+    {
+        char kind;
+        std::string room;
+        std::string message;
+        while (Bus::receive(*link->connection, kind, room, message))
+        {
+            auto frame = std::make_shared<const std::string>(Bus::frame(kind, room, message)); // One copy for every link
+
+            std::shared_ptr<const LinkList> current;
+            {
+                std::lock_guard<std::mutex> lock(links_mutex);
+                current = links;
+            }
+            for (const std::shared_ptr<Link>& other : *current)
+            {
+                if (other != link)
+                {
+                    enqueue(*other, frame);
+                }
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(links_mutex);
+            auto updated = std::make_shared<LinkList>(*links);
+            updated->erase(std::remove(updated->begin(), updated->end(), link), updated->end());
+            links = std::move(updated);
+        }
+        {
+            std::lock_guard<std::mutex> lock(link->mutex);
+            link->closed = true;
+        }
+        link->ready.notify_one();
+    }
+
+    static void enqueue(Link& link, const std::shared_ptr<const std::string>& frame)
+    {
+        {
+            std::lock_guard<std::mutex> lock(link.mutex);
+            if (link.closed)
+            {
+                return;
+            }
+            if (link.queue.size() >= MAX_QUEUED)
+            {
+                // Too far behind to catch up, its reading thread sees the socket go and cleans up
+                std::cerr << "Bus link fell " << MAX_QUEUED << " frames behind, dropping it." << std::endl;
+                link.closed = true;
+                link.queue.clear();
+                shutdown(link.connection->ClientSocket, SD_BOTH);
+            }
+            else
+            {
+                link.queue.push_back(frame);
+            }
+        }
+        link.ready.notify_one();
+    }
+
+    // The link's writing thread, sends whatever has been queued for it until it closes
+    static void write_out(std::shared_ptr<Link> link)
+    {
+        std::deque<std::shared_ptr<const std::string>> batch;
+        while (true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(link->mutex);
+                link->ready.wait(lock, [&link] { return link->closed || !link->queue.empty(); });
+                if (link->closed)
+                {
+                    return;
+                }
+                batch.swap(link->queue);
+            }
+            for (const std::shared_ptr<const std::string>& frame : batch)
+            {
+                link->connection->send_shared(frame);
+            }
+            batch.clear();
+        }
+    }
+};
+
+// A ChatServer's connection to the bus
+/*
+* -publish() sends local traffic to the broker once, whatever the number of other processes
+* -A background thread hands frames from other processes to the handler
+* -Reconnects if the broker goes away, the server keeps working locally meanwhile
+*/
+class BusLink
+{
+public:
+    typedef std::function<void(char kind, const std::string& room, const std::string& message)> Handler;
+
+    void start(unsigned short port, Handler handler)
+    {
+        this->port = port;
+        this->handler = std::move(handler);
+
+        receiveThread = std::thread([this] { this->receive_loop(); });
+        receiveThread.detach();
+    }
+
+    void publish(char kind, const std::string& room, const std::string& message)
+    {
+        std::shared_ptr<Connection> current = get_link();
+        if (current)
+        {
+            current->send_message(Bus::frame(kind, room, message));
+        }
+    }
+
+private:
+    unsigned short port = 0;
+    Handler handler;
+    std::thread receiveThread;
+    std::mutex link_mutex;
+    std::shared_ptr<Connection> link; // Null while disconnected
+
+    std::shared_ptr<Connection> get_link()
+    {
+        std::lock_guard<std::mutex> lock(link_mutex);
+        return link;
+    }
+
+    void set_link(std::shared_ptr<Connection> current)
+    {
+        std::lock_guard<std::mutex> lock(link_mutex);
+        link = std::move(current);
+    }
+
+    void receive_loop()
+    {
+        while (true)
+        {
+            SOCKET s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+            IPv4Endpoint endpoint("127.0.0.1", port);
+            if (s == INVALID_SOCKET || ::connect(s, endpoint.as_sockaddr(), endpoint.size()) == SOCKET_ERROR)
+            {
+                if (s != INVALID_SOCKET)
+                {
+                    closesocket(s);
+                }
+                std::this_thread::sleep_for(std::chrono::seconds(1));
+                continue;
+            }
+
+            auto current = std::make_shared<Connection>(s);
+            current->max_message = Bus::MAX_FRAME;
+            set_link(current);
+            std::cout << "Connected to bus on port: " << port << std::endl;
+
+            char kind;
+            std::string room;
+            std::string message;
+            while (Bus::receive(*current, kind, room, message))
+            {
+                handler(kind, room, message);
+            }
+
+            set_link(nullptr);
+            std::cerr << "Lost the bus, reconnecting." << std::endl;
+        }
+    }
+};
@@ -0,0 +1,317 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <filesystem>
+#include <stdexcept>
+#include <cstdint>
+#include <cstring>
+
+#include "Connection.cpp"
+
+#include <windows.h> // File mapping (winsock2.h is already included above)
+
+// One memory mapped segment file of the chat log
+/*
+* -Holds messages exactly as they are sent on the wire (null terminated), back to back
+* -Writable segments are created at a fixed capacity and trimmed to what was used on close
+* -Segments left on disk from earlier runs are opened read only
+* -A closed room's writable segment can outlive it (queued catch up holds it), so a reopened room
+*  must be able to read it while it is still open for writing: every open shares read and write
+*/
+class HistorySegment
+{
+public:
+    const uint64_t first_sequence;
+
+    // Create a new, writable segment
+    HistorySegment(const std::string& path, uint64_t first_sequence, uint32_t capacity)
+        : first_sequence(first_sequence), capacity(capacity), used(0), writable(true)
+    {
+        file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+            CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+        map(path, PAGE_READWRITE, FILE_MAP_WRITE);
+    }
+
+    // Open an existing segment for reading
+    HistorySegment(const std::string& path, uint64_t first_sequence)
+        : first_sequence(first_sequence), capacity(0), used(0), writable(false)
+    {
+        file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+
+        LARGE_INTEGER size;
+        if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &size))
+        {
+            DWORD error = GetLastError();
+            close();
+            throw std::runtime_error("Failed to open history segment " + path + ": " + std::to_string(error));
+        }
+        if (size.QuadPart == 0)
+        {
+            close();
+            throw std::runtime_error("Empty history segment: " + path);
+        }
+        capacity = (uint32_t)size.QuadPart;
+        used = capacity;
+        map(path, PAGE_READONLY, FILE_MAP_READ);
+    }
+
+    ~HistorySegment()
+    {
+        close();
+    }
+
+    HistorySegment(const HistorySegment&) = delete;
+    HistorySegment& operator=(const HistorySegment&) = delete;
+
+    // Copy a frame into the segment. Returns false if it doesn't fit.
+    bool append(const char* frame, uint32_t length, uint32_t& offset)
+    {
+        if (!writable || capacity - used < length)
+        {
+            return false;
+        }
+        memcpy(view + used, frame, length);
+        offset = used;
+        used += length;
+        return true;
+    }
+
+    const char* data() const { return view; }
+    uint32_t size() const { return used; }
+
+private:
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+    char* view = nullptr;
+    uint32_t capacity;
+    uint32_t used;
+    bool writable;
+
+    void map(const std::string& path, DWORD protect, DWORD access)
+    {
+        if (file != INVALID_HANDLE_VALUE)
+        {
+            mapping = CreateFileMappingA(file, nullptr, protect, 0, writable ? capacity : 0, nullptr);
+        }
+        if (mapping != nullptr)
+        {
+            view = static_cast<char*>(MapViewOfFile(mapping, access, 0, 0, 0));
+        }
+        if (view == nullptr)
+        {
+            DWORD error = GetLastError();
+            close();
+            throw std::runtime_error("Failed to map history segment " + path + ": " + std::to_string(error));
+        }
+    }
+
+    void close()
+    {
+        if (view != nullptr)
+        {
+            UnmapViewOfFile(view);
+            view = nullptr;
+        }
+        if (mapping != nullptr)
+        {
+            CloseHandle(mapping);
+            mapping = nullptr;
+        }
+        if (file != INVALID_HANDLE_VALUE)
+        {
+            if (writable) // Drop the unused tail so the file only holds messages
+            {
+                LARGE_INTEGER end;
+                end.QuadPart = used;
+                SetFilePointerEx(file, end, nullptr, FILE_BEGIN);
+                SetEndOfFile(file);
+            }
+            CloseHandle(file);
+            file = INVALID_HANDLE_VALUE;
+        }
+    }
+};
+
+// Append only chat log for one room
+/*
+* -Messages are numbered from 1 and written to memory mapped segment files
+* -The last ring_capacity messages are indexed in memory for catch up
+* -Catch up queues buffers that point straight into the mapped segments, no copies
+* -Not thread safe, the owning room serializes access
+*/
+class ChatHistory
+{
+public:
+    ChatHistory(const std::string& directory, size_t ring_capacity = 100, uint32_t segment_capacity = 1 << 20)
+        : directory(directory), ring(ring_capacity), segment_capacity(segment_capacity)
+    {
+        std::filesystem::create_directories(directory);
+        recover();
+    }
+
+    // Record a message and return its sequence number
+    // Throws if a new segment can't be created, nothing is recorded then
+    uint64_t append(const std::string& message)
+    {
+        uint32_t length = (uint32_t)message.size() + 1; // Keep the null terminator, as on the wire
+        uint32_t offset = 0;
+
+        if (!current || !current->append(message.c_str(), length, offset))
+        {
+            uint64_t sequence = next_sequence;
+            current = std::make_shared<HistorySegment>(segment_path(sequence), sequence,
+                std::max(segment_capacity, length));
+            current->append(message.c_str(), length, offset);
+        }
+
+        push({ next_sequence, current, offset, length });
+        return next_sequence++;
+    }
+
+    // Sequence number of the newest message, 0 if there is none
+    uint64_t last_sequence() const
+    {
+        return next_sequence - 1;
+    }
+
+    // Sequence number of the oldest message still retained for catch up, the next one if there is none
+    uint64_t first_sequence() const
+    {
+        return count == 0 ? next_sequence : ring[head].sequence;
+    }
+
+    // Queue every retained message newer than `since` for the client, straight from the mapped segments
+    // Adjacent messages are queued as one buffer, and the whole catch up goes out in one WSASend
+    void replay(Connection& client, uint64_t since)
+    {
+        const Entry* run = nullptr; // First entry of the current run of adjacent messages
+        uint32_t length = 0;
+
+        for (size_t i = 0; i < count; i++)
+        {
+            const Entry& entry = ring[(head + i) % ring.size()];
+            if (entry.sequence <= since)
+            {
+                continue;
+            }
+
+            if (run != nullptr && run->segment == entry.segment && run->offset + length == entry.offset)
+            {
+                length += entry.length;
+                continue;
+            }
+            if (run != nullptr)
+            {
+                client.queue(run->segment->data() + run->offset, length, run->segment);
+            }
+            run = &entry;
+            length = entry.length;
+        }
+
+        if (run != nullptr)
+        {
+            client.queue(run->segment->data() + run->offset, length, run->segment);
+        }
+    }
+
+private:
+    struct Entry
+    {
+        uint64_t sequence;
+        std::shared_ptr<HistorySegment> segment; // Keeps the segment mapped while it is indexed
+        uint32_t offset;
+        uint32_t length;
+    };
+
+    std::string directory;
+    std::vector<Entry> ring;
+    size_t head = 0;  // Oldest entry
+    size_t count = 0;
+    uint32_t segment_capacity;
+    uint64_t next_sequence = 1;
+    std::shared_ptr<HistorySegment> current; // Segment being appended to
+
+    void push(Entry entry)
+    {
+        if (ring.empty())
+        {
+            return;
+        }
+        if (count == ring.size())
+        {
+            ring[head] = std::move(entry);
+            head = (head + 1) % ring.size();
+        }
+        else
+        {
+            ring[(head + count) % ring.size()] = std::move(entry);
+            count++;
+        }
+    }
+
+    std::string segment_path(uint64_t first_sequence) const
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "%020llu.log", (unsigned long long)first_sequence);
+        return directory + "/" + name;
+    }
+
+    // Rebuild the ring from segments left by an earlier run (or an earlier instance of the room)
+    void recover()
+    {
+        std::vector<uint64_t> segments;
+        for (const auto& file : std::filesystem::directory_iterator(directory))
+        {
+            if (file.path().extension() == ".log")
+            {
+                segments.push_back(std::stoull(file.path().stem().string()));
+            }
+        }
+        std::sort(segments.begin(), segments.end());
+
+        // Walk back from the newest segment until the ring is full
+        std::vector<std::vector<Entry>> recovered;
+        size_t total = 0;
+        for (auto it = segments.rbegin(); it != segments.rend() && total < ring.size(); ++it)
+        {
+            // Skip segments that were created but never written to. Any other failure is thrown:
+            // carrying on without a segment would hand out its sequence numbers again.
+            if (std::filesystem::file_size(segment_path(*it)) == 0)
+            {
+                continue;
+            }
+            auto segment = std::make_shared<HistorySegment>(segment_path(*it), *it);
+
+            std::vector<Entry> entries;
+            uint64_t sequence = *it;
+            uint32_t offset = 0;
+            while (offset < segment->size())
+            {
+                const char* frame = segment->data() + offset;
+                uint32_t length = (uint32_t)strnlen(frame, segment->size() - offset) + 1;
+                if (length == 1 || offset + length > segment->size())
+                {
+                    break; // Unused or torn tail
+                }
+                entries.push_back({ sequence++, segment, offset, length });
+                offset += length;
+            }
+
+            next_sequence = std::max(next_sequence, sequence);
+            total += entries.size();
+            recovered.push_back(std::move(entries));
+        }
+
+        for (auto it = recovered.rbegin(); it != recovered.rend(); ++it)
+        {
+            for (Entry& entry : *it)
+            {
+                push(std::move(entry));
+            }
+        }
+    }
+};
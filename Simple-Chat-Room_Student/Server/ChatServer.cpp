@@ -12,14 +12,25 @@
 #include <vector>
 #include <sstream>
 #include <map>
+#include <memory>
 #include <thread>
 #include <mutex>
+#include <optional>
+#include <chrono>
 
 #include "Socket.h"
 #include "IPEndpoint.h"
 #include "WSASession.h"
 
 #include "Connection.cpp"
+#include "ChatHistory.cpp"
+#include "FanoutPool.cpp"
+#include "RateLimiter.cpp"
+#include "ChatBus.cpp"
+#include "NameIndex.cpp"
+#include "Flusher.cpp"
+#include "SessionTable.cpp"
+#include "RoomRegistry.cpp"
 
 // TCP Server
 /*
@@ -79,6 +90,17 @@ public:
     std::thread connectionHandlerThread;
     std::thread clientReceiveThread;
 
+    RateLimitConfig rate_limits; // Per client, set before start
+    std::string history_root = "history";
+
+    // Federate with other ChatServer processes over the local bus on this port (0 for none)
+    unsigned short bus_port = 0;
+    bool bus_hub = false; // Host the bus broker in this process
+
+    // How long a flush thread lets messages for the same client pile up before writing them
+    std::chrono::microseconds flush_window{ 200 };
+    int metrics_interval_seconds = 10; // 0 to only report through /stats
+
     void start(const char* ip, unsigned short port)
     {
         IPv4Endpoint endpoint(ip, port);
@@ -87,27 +109,51 @@ public:
 
         std::cout << "Server listening on port: " << port << std::endl;
 
-        initiate_chat_room();
+        // Each process keeps its own history, even when several federate
+        rooms = std::make_unique<RoomRegistry>(history_root + "/" + std::to_string(port), &fanout);
+        flusher = std::make_unique<Flusher>(flush_window);
 
-        while (true)
+        if (bus_port != 0)
         {
+            if (bus_hub)
+            {
+                broker.start(bus_port);
+            }
+            bus.start(bus_port, [this](char kind, const std::string& room, const std::string& message) {
+                this->deliver_from_bus(kind, room, message);
+            });
+        }
 
+        initiate_chat_room();
+
+        if (metrics_interval_seconds > 0)
+        {
+            std::thread([this] { this->report_metrics(); }).detach();
         }
+        std::thread([this] { this->expire_sessions(); }).detach();
+
+        connectionHandlerThread.join();
     }
 
     void initiate_chat_room()
     {
         std::cout << "Starting chat room." << std::endl;
         connectionHandlerThread = std::thread([this] {this->ConnectionHandler(); });
-
-        connectionHandlerThread.detach();
     }
 
 
 private:
 
-    std::map<SOCKET, Connection> connections;
-    std::mutex connections_mutex;
+    const std::string default_room = "lobby";
+
+    FanoutPool fanout;
+    std::unique_ptr<RoomRegistry> rooms;
+    BusBroker broker;
+    BusLink bus;
+    RateLimitStats rate_limit_stats;
+    NameIndex names;
+    std::unique_ptr<Flusher> flusher;
+    SessionTable sessions;
 
 
     void ConnectionHandler()
@@ -118,7 +164,8 @@ private:
             {
                 SOCKET client = accept();
                 //Create a connection
-                Connection connection = Connection(client);
+                std::shared_ptr<Connection> connection = std::make_shared<Connection>(client);
+                connection->set_flusher(flusher.get());
 
                 add_client_to_room(connection);
             }
@@ -129,66 +176,316 @@ private:
         }
     }
 
-    void clientReceive(Connection client) // Receive Thread
+    // The first message is the client's name, or "/resume <token> <last seq> <name>" after a reconnect
+    void clientReceive(std::shared_ptr<Connection> client) // Receive Thread
     {
-        char nameBuffer[1024] = {};
-        int nameBytes = recv(client.ClientSocket, nameBuffer, sizeof(nameBuffer), 0);
+        std::string requested;
+        if (!client->receive_message(requested, true))
+        {
+            return;
+        }
+
+        std::shared_ptr<Room> room = resume_session(client, requested);
+        if (room)
+        {
+            std::cout << "Client : " << client->client_name << " has resumed in " << room->name << std::endl;
+        }
+        else
+        {
+            claim_name(client, requested);
+            std::cout << "Client : " << client->client_name << " has joined!" << std::endl;
 
-        client.client_name = nameBuffer;
+            client->room_name = default_room;
+            sessions.open(client);
+            client->send_message("!session " + client->session + " " + client->client_name);
+            room = join_room(client, default_room);
+        }
 
-        std::cout << "Client : " << client.client_name << " has joined!" << std::endl;
+        RateLimiter limiter(rate_limits, rate_limit_stats);
+        bool throttling = false;
 
-        while (true)
+        std::string message;
+        while (client->receive_message(message))
         {
-            char buffer[1024] = {};
-            int bytes;
+            if (!message.empty() && message[0] == '/') // Commands are never limited, only what gets fanned out
+            {
+                handle_command(client, room, message);
+                continue;
+            }
+
+            // Drop whatever goes over the client's limits before it can be fanned out
+            if (rate_limits.enabled && !limiter.allow(message.size()))
+            {
+                if (!throttling) // Warn once per burst, not once per dropped message
+                {
+                    std::cout << client->client_name << " is being rate limited." << std::endl;
+                    client->send_message("You are sending too fast, messages are being dropped.");
+                    throttling = true;
+                }
+                continue;
+            }
+            throttling = false;
+
+            std::string output = client->client_name + ": " + message;
 
-            bytes = recv(client.ClientSocket, buffer, sizeof(buffer), 0);
+            std::cout << "[" << room->name << "] " << output << std::endl;
 
-            if (bytes <= 0)
+            while (!room->publish(output, client->ClientSocket)) // Send what other people have been saying.
             {
-                break;
+                // The room was closed under us: catch up from where we were in the room that replaced it
+                room = join_room(client, room->name, room->last_sequence(), false);
             }
+            bus.publish(Bus::MESSAGE, room->name, output);
+        }
 
-            std::string output = client.client_name + ": " + buffer;
+        std::chrono::steady_clock::time_point resumable_until;
+        if (sessions.close(*client, resumable_until))
+        {
+            leave_room(client, room, " disconnected.");
+            names.release(client->client_name, *client, client->session, resumable_until); // Held for a resume
+        }
+        else // Resumed on a new connection, nobody needs to hear about it
+        {
+            rooms->leave(room, client->ClientSocket);
+            names.release(client->client_name, *client);
+        }
 
-            strncpy_s(buffer, output.c_str(), sizeof(buffer));
+        std::cout << client->client_name << " disconnected.";
+        if (limiter.throttled > 0)
+        {
+            std::cout << " (" << limiter.throttled << " messages throttled)";
+        }
+        std::cout << std::endl;
 
-            std::cout << buffer << std::endl;
+        shutdown(client->ClientSocket, SD_BOTH); // Closed when the last reference goes
+    }
 
-            for (std::map<SOCKET, Connection>::iterator it = connections.begin(); it != connections.end(); it++)
+    // Commands:
+    // /join <room> [seq] - Move to another room, creating it if needed, and catch up on its history
+    //                     (only messages after seq when resuming)
+    // /leave       - Go back to the lobby
+    // /rooms       - List open rooms
+    // /stats       - Rate limiting and flush statistics
+    // /msg <name> <text> - Private message to one user
+    void handle_command(const std::shared_ptr<Connection>& client, std::shared_ptr<Room>& room, const std::string& message)
+    {
+        std::istringstream command(message);
+        std::string name;
+        std::string argument;
+        command >> name >> argument;
+
+        if (name == "/join" && !argument.empty())
+        {
+            std::optional<uint64_t> since;
+            uint64_t sequence;
+            if (command >> sequence)
             {
-                if (it->first != client.ClientSocket)
-                {
+                since = sequence;
+            }
 
-                    send(it->first, buffer, sizeof(buffer), 0); // Send what other people have been saying.
-                }
+            if (argument != room->name || since)
+            {
+                leave_room(client, room, " left the room.");
+                room = join_room(client, argument, since);
+            }
+        }
+        else if (name == "/leave")
+        {
+            if (room->name != default_room)
+            {
+                leave_room(client, room, " left the room.");
+                room = join_room(client, default_room);
+            }
+        }
+        else if (name == "/rooms")
+        {
+            std::string output = "Rooms:";
+            for (auto& entry : rooms->list(50))
+            {
+                output += " " + entry.first + "(" + std::to_string(entry.second) + ")";
+            }
+            client->send_message(output);
+        }
+        else if (name == "/msg" && !argument.empty())
+        {
+            std::string text;
+            std::getline(command >> std::ws, text);
+
+            std::shared_ptr<Connection> target = names.find(argument);
+            if (!target)
+            {
+                client->send_message("No user named " + argument + ".");
+            }
+            else if (!text.empty())
+            {
+                target->send_message("[PM] " + client->client_name + ": " + text);
+                client->send_message("[PM to " + argument + "] " + text);
             }
         }
+        else if (name == "/stats")
+        {
+            client->send_message("Throttled messages: " + std::to_string(rate_limit_stats.throttled_messages.load()) +
+                ", throttled clients: " + std::to_string(rate_limit_stats.throttled_clients.load()));
+            client->send_message(flusher->stats.report());
+        }
+        else
+        {
+            client->send_message("Unknown command. Use /join <room>, /leave, /rooms, /msg <name> <text> or /stats");
+        }
+    }
+
+    // Drop sessions and name reservations whose resume window has run out
+    void expire_sessions()
+    {
+        while (true)
+        {
+            std::this_thread::sleep_for(std::max<std::chrono::seconds>(std::chrono::seconds(1), sessions.resume_window / 4));
+            sessions.sweep();
+            names.sweep();
+        }
+    }
+
+    // Print the flush counters whenever there was traffic since the last report
+    void report_metrics()
+    {
+        uint64_t last_ticks = 0;
+        while (true)
+        {
+            std::this_thread::sleep_for(std::chrono::seconds(metrics_interval_seconds));
+            if (flusher->stats.ticks != last_ticks)
+            {
+                last_ticks = flusher->stats.ticks;
+                std::cout << flusher->stats.report() << std::endl;
+            }
+        }
+    }
+
+    // Give a reconnecting client its name back and only the messages it missed
+    // Returns null if the request isn't a resume or the session has expired, the caller then starts afresh
+    // and `requested` is left holding the name to claim
+    std::shared_ptr<Room> resume_session(const std::shared_ptr<Connection>& client, std::string& requested)
+    {
+        std::istringstream handshake(requested);
+        std::string command;
+        std::string token;
+        uint64_t last_sequence = 0;
+        if (!(handshake >> command) || command != "/resume" || !(handshake >> token >> last_sequence))
+        {
+            return nullptr;
+        }
+        std::getline(handshake >> std::ws, requested);
+
+        std::shared_ptr<Connection> previous;
+        std::optional<SessionTable::Session> session = sessions.resume(token, client, previous);
+        if (!session)
+        {
+            client->send_message("Your session has expired.");
+            return nullptr;
+        }
+
+        if (names.take_over(session->name, client, previous, token))
+        {
+            client->client_name = session->name;
+        }
+        else // Not reserved for us, someone else has it now
+        {
+            claim_name(client, session->name);
+        }
+        if (previous)
+        {
+            shutdown(previous->ClientSocket, SD_BOTH); // Its thread notices and leaves quietly
+        }
+
+        client->send_message("!session " + token + " " + client->client_name);
+        return join_room(client, session->room, last_sequence, !previous);
+    }
+
+    // Names are single words and unique, a taken name gets a number appended
+    // '#' and '!' start sequence numbers and control frames, so names can't start with them
+    void claim_name(const std::shared_ptr<Connection>& client, const std::string& requested)
+    {
+        std::string base;
+        for (char c : requested)
+        {
+            base += isspace((unsigned char)c) ? '_' : c;
+        }
+        if (!base.empty() && (base[0] == '#' || base[0] == '!'))
+        {
+            base[0] = '_';
+        }
+        if (base.empty())
+        {
+            base = "guest";
+        }
+
+        std::string name = base;
+        for (int suffix = 2; !names.claim(name, client); suffix++)
+        {
+            name = base + "_" + std::to_string(suffix);
+        }
+        client->client_name = name;
 
-        std::unique_lock<std::mutex> removeConnection(connections_mutex);
+        if (name != requested)
+        {
+            client->send_message("Your name is " + name + ".");
+        }
+    }
 
-        closesocket(client.ClientSocket);
+    // The client gets "!joining <room> <since>", the history (or what it missed), then "!joined <room> <seq>"
+    // with the sequence number it is caught up to. Clients resume from the last sequence number they saw.
+    // If what it missed goes back further than the room retains, "!gap <seq>" comes before the history:
+    // everything after `since` and before <seq> is lost to it.
+    std::shared_ptr<Room> join_room(const std::shared_ptr<Connection>& client, const std::string& name,
+        std::optional<uint64_t> since = std::nullopt, bool announce = true)
+    {
+        client->send_message("!joining " + name + " " + std::to_string(since.value_or(0)));
 
-        std::string disconnectMessage = client.client_name + " disconnected.";
+        uint64_t joined_at = 0;
+        std::shared_ptr<Room> room = rooms->join(name, client, since, &joined_at);
+        client->room_name = name;
+        sessions.update(*client);
 
-        std::cout << disconnectMessage << std::endl;
+        client->send_message("You joined " + name + " at #" + std::to_string(joined_at) + ".");
+        client->send_message("!joined " + name + " " + std::to_string(joined_at));
 
-        for (std::map<SOCKET, Connection>::iterator it = connections.begin(); it != connections.end(); it++)
+        if (!announce)
         {
-            if (it->first != client.ClientSocket)
+            return room;
+        }
+        std::string notice = client->client_name + " joined " + name + ".";
+        room->broadcast(notice, client->ClientSocket);
+        bus.publish(Bus::NOTICE, name, notice);
+        return room;
+    }
+
+    void leave_room(const std::shared_ptr<Connection>& client, const std::shared_ptr<Room>& room, const std::string& reason)
+    {
+        rooms->leave(room, client->ClientSocket);
+
+        std::string notice = client->client_name + reason;
+        room->broadcast(notice, client->ClientSocket);
+        bus.publish(Bus::NOTICE, room->name, notice);
+    }
+
+    // Traffic from other processes only reaches rooms that have members here
+    // Looks the room up again if it was closed before the message got in
+    void deliver_from_bus(char kind, const std::string& name, const std::string& message)
+    {
+        std::shared_ptr<Room> room;
+        while ((room = rooms->find(name)))
+        {
+            bool delivered = kind == Bus::MESSAGE
+                ? room->publish(message, INVALID_SOCKET)
+                : room->broadcast(message, INVALID_SOCKET);
+            if (delivered)
             {
-                send(it->first, disconnectMessage.c_str(), sizeof(disconnectMessage), 0); // Send what other people have been saying.
+                return;
             }
         }
-        connections.erase(client.ClientSocket);
     }
 
-    void add_client_to_room(Connection c)
+    void add_client_to_room(std::shared_ptr<Connection> c)
     {
-        std::unique_lock<std::mutex> removeConnection(connections_mutex);
-        connections.insert({ c.ClientSocket, c });
-
         clientReceiveThread = std::thread([this, c] {this->clientReceive(c); });
         clientReceiveThread.detach();
     }
@@ -1,3 +1,4 @@
+#pragma once
 
 #include <iostream>
 #include <string>
@@ -6,6 +7,10 @@
 #include <map>
 #include <thread>
 #include <mutex>
+#include <algorithm>
+#include <memory>
+#include <cstdint>
+#include <stdexcept>
 
 #include "Socket.h"
 #include "IPEndpoint.h"
@@ -13,14 +18,233 @@
 
 
 
-class Connection
+class Connection;
+
+struct FlushResult
+{
+	size_t frames = 0;    // Messages written
+	size_t sends = 0;     // WSASend calls it took
+	bool blocked = false; // The socket buffer filled up, the rest is still queued
+	bool more = false;    // Still queued frames, the scheduler has to flush it again
+};
+
+// Something that writes out connections' queued frames later, see Flusher
+class FlushScheduler
+{
+public:
+	virtual ~FlushScheduler() = default;
+	virtual void schedule(std::shared_ptr<Connection> c) = 0;
+};
+
+class Connection : public std::enable_shared_from_this<Connection>
 {
 public:
 	SOCKET ClientSocket;
 	std::string client_name = "";
+	std::string room_name = "";
+	std::string session = ""; // Resume token, see SessionTable
+
+	// When set, frames wait in the outbox and the scheduler writes them out in batches.
+	// Otherwise every frame is written straight away by the thread that sends it.
+	FlushScheduler* flusher = nullptr;
+
+	// Longest message receive_message accepts; clients are held to the size of the original fixed receive buffer
+	static const size_t MAX_CLIENT_MESSAGE = 1024;
+	size_t max_message = MAX_CLIENT_MESSAGE;
 
 	Connection(const SOCKET ClientSocket)
 		: ClientSocket(ClientSocket)
 	{
 	}
-};
\ No newline at end of file
+
+	// Rooms and fan-out jobs can still hold the connection after its thread ends,
+	// so the socket is only closed once the last of them lets go
+	~Connection()
+	{
+		closesocket(ClientSocket);
+	}
+
+	Connection(const Connection&) = delete;
+	Connection& operator=(const Connection&) = delete;
+
+	// Hand writes to a scheduler. The socket becomes non-blocking, so a client that stops reading
+	// only leaves its own frames queued instead of holding up the scheduler's thread.
+	void set_flusher(FlushScheduler* scheduler)
+	{
+		unsigned long mode = 1;
+		if (ioctlsocket(ClientSocket, FIONBIO, &mode) == SOCKET_ERROR)
+		{
+			throw std::runtime_error("Failed to set non-blocking mode: " +
+				std::to_string(WSAGetLastError()));
+		}
+		flusher = scheduler;
+	}
+
+	// Messages are framed on the wire as null terminated strings.
+	void send_message(const std::string& message)
+	{
+		send_shared(std::make_shared<const std::string>(message));
+	}
+
+	// A frame shared by many recipients, nobody gets their own copy
+	void send_shared(const std::shared_ptr<const std::string>& message)
+	{
+		queue(message->c_str(), (uint32_t)message->size() + 1, message); // Include the null terminator
+	}
+
+	// Queue bytes that are already framed, `owner` keeps them alive until they are written
+	void queue(const char* data, uint32_t length, std::shared_ptr<const void> owner)
+	{
+		bool schedule = false;
+		{
+			std::lock_guard<std::mutex> lock(outbox_mutex);
+			outbox.push_back({ data, length, std::move(owner) });
+			if (flusher != nullptr && !flush_scheduled)
+			{
+				flush_scheduled = true;
+				schedule = true;
+			}
+		}
+
+		if (flusher == nullptr)
+		{
+			flush();
+		}
+		else if (schedule)
+		{
+			flusher->schedule(shared_from_this());
+		}
+	}
+
+	// Write everything queued with as few WSASend calls as possible
+	// Several threads can write to the same client, so writes are serialized
+	// With a scheduler it stays scheduled until a flush leaves nothing queued, so it is never queued twice
+	FlushResult flush()
+	{
+		std::lock_guard<std::mutex> send_lock(send_mutex);
+
+		std::vector<Frame> frames;
+		{
+			std::lock_guard<std::mutex> lock(outbox_mutex);
+			frames.swap(outbox);
+		}
+
+		FlushResult result;
+		size_t first = 0; // Frames before this one have been written
+		std::vector<WSABUF> buffers;
+		buffers.reserve(std::min(frames.size(), MAX_BUFFERS));
+		while (first < frames.size() && !failed)
+		{
+			buffers.clear();
+			for (size_t i = first; i < frames.size() && i < first + MAX_BUFFERS; i++)
+			{
+				WSABUF buffer;
+				buffer.buf = const_cast<char*>(frames[i].data);
+				buffer.len = frames[i].length;
+				buffers.push_back(buffer);
+			}
+
+			DWORD bytes = 0;
+			result.sends++;
+			if (WSASend(ClientSocket, buffers.data(), (DWORD)buffers.size(), &bytes, 0, nullptr, nullptr) == SOCKET_ERROR)
+			{
+				if (WSAGetLastError() == WSAEWOULDBLOCK)
+				{
+					result.blocked = true;
+				}
+				else
+				{
+					failed = true;
+				}
+				break;
+			}
+
+			// Skip whatever was sent, a partial send leaves us part way into a frame
+			while (first < frames.size() && bytes >= frames[first].length)
+			{
+				bytes -= frames[first].length;
+				first++;
+			}
+			if (first < frames.size())
+			{
+				frames[first].data += bytes;
+				frames[first].length -= bytes;
+			}
+		}
+		result.frames = first;
+
+		std::lock_guard<std::mutex> lock(outbox_mutex);
+		if (result.blocked) // Back in front of anything queued meanwhile, to keep the order
+		{
+			outbox.insert(outbox.begin(), std::make_move_iterator(frames.begin() + first),
+				std::make_move_iterator(frames.end()));
+		}
+		if (outbox.empty())
+		{
+			flush_scheduled = false;
+		}
+		result.more = flush_scheduled;
+		return result;
+	}
+
+	// Reads the next null terminated message. Returns false once the client has disconnected,
+	// or if it sent more than max_message bytes without a terminator (the caller then drops it).
+	// The client sends its name without a terminator, so the handshake can take a whole chunk as the message.
+	bool receive_message(std::string& message, bool allow_unterminated = false)
+	{
+		while (true)
+		{
+			size_t end = pending.find('\0');
+			if (end != std::string::npos)
+			{
+				message = pending.substr(0, end);
+				pending.erase(0, end + 1);
+				return true;
+			}
+			if (pending.size() > max_message)
+			{
+				return false; // No frame is that long, don't buffer it without limit
+			}
+
+			char buffer[1024];
+			int bytes = recv(ClientSocket, buffer, sizeof(buffer), 0);
+			if (bytes == SOCKET_ERROR && WSAGetLastError() == WSAEWOULDBLOCK) // Non-blocking, see set_flusher
+			{
+				WSAPOLLFD fd = {};
+				fd.fd = ClientSocket;
+				fd.events = POLLRDNORM;
+				WSAPoll(&fd, 1, -1);
+				continue;
+			}
+			if (bytes <= 0)
+			{
+				return false;
+			}
+
+			if (allow_unterminated && pending.empty() && std::find(buffer, buffer + bytes, '\0') == buffer + bytes)
+			{
+				message.assign(buffer, bytes);
+				return true;
+			}
+			pending.append(buffer, bytes);
+		}
+	}
+
+private:
+	static const size_t MAX_BUFFERS = 512; // Buffers per WSASend
+
+	struct Frame
+	{
+		const char* data;
+		uint32_t length;
+		std::shared_ptr<const void> owner;
+	};
+
+	std::mutex outbox_mutex;
+	std::vector<Frame> outbox;
+	bool flush_scheduled = false;
+
+	std::mutex send_mutex;
+	bool failed = false; // Stop writing once the client is gone
+	std::string pending; // Bytes received but not yet returned as a message
+};
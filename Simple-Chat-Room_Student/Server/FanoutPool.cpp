@@ -0,0 +1,203 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <functional>
+
+#include "Connection.cpp"
+
+// Unbounded multi-producer single-consumer queue (Vyukov)
+/*
+* -Producers only do one atomic exchange, so pushing never blocks
+* -Only the owning consumer may pop
+*/
+template <typename T>
+class MpscQueue
+{
+public:
+    MpscQueue()
+        : head(new Node()), tail(head.load())
+    {
+    }
+
+    ~MpscQueue()
+    {
+        T ignored;
+        while (pop(ignored))
+        {
+        }
+        delete tail;
+    }
+
+    MpscQueue(const MpscQueue&) = delete;
+    MpscQueue& operator=(const MpscQueue&) = delete;
+
+    void push(T value)
+    {
+        Node* node = new Node();
+        node->value = std::move(value);
+        Node* previous = head.exchange(node, std::memory_order_acq_rel);
+        previous->next.store(node, std::memory_order_release);
+    }
+
+    bool pop(T& value)
+    {
+        Node* next = tail->next.load(std::memory_order_acquire);
+        if (next == nullptr)
+        {
+            return false;
+        }
+        value = std::move(next->value);
+        delete tail;
+        tail = next; // The popped node becomes the new stub
+        return true;
+    }
+
+    bool empty() const
+    {
+        return tail->next.load(std::memory_order_acquire) == nullptr;
+    }
+
+private:
+    struct Node
+    {
+        std::atomic<Node*> next{ nullptr };
+        T value;
+    };
+
+    std::atomic<Node*> head; // Most recently pushed, shared by producers
+    Node* tail;              // Stub in front of the oldest value, owned by the consumer
+};
+
+// Recipients of a large room that belong to one fan-out worker
+typedef std::vector<std::shared_ptr<Connection>> Partition;
+
+// Worker threads that share the fan-out of large rooms
+/*
+* -Large rooms split their members into one partition per worker
+* -A message is queued to every worker with that worker's partition, the text is shared, not copied
+* -A client always lands on the same worker, so it still gets a room's messages in order
+* -Idle workers park on an atomic wait instead of spinning
+*/
+class FanoutPool
+{
+public:
+    explicit FanoutPool(size_t worker_count = std::thread::hardware_concurrency())
+    {
+        if (worker_count == 0) worker_count = 4; // Default to 4 if unable to detect
+
+        for (size_t i = 0; i < worker_count; i++)
+        {
+            workers.push_back(std::make_unique<Worker>());
+        }
+        for (size_t i = 0; i < worker_count; i++)
+        {
+            workers[i]->thread = std::thread([this, i] { this->worker_loop(*workers[i]); });
+        }
+    }
+
+    ~FanoutPool()
+    {
+        running = false;
+        for (auto& worker : workers)
+        {
+            wake(*worker);
+        }
+        for (auto& worker : workers)
+        {
+            worker->thread.join();
+        }
+    }
+
+    FanoutPool(const FanoutPool&) = delete;
+    FanoutPool& operator=(const FanoutPool&) = delete;
+
+    size_t size() const
+    {
+        return workers.size();
+    }
+
+    // Which worker (and so which partition) a client belongs to
+    size_t worker_for(SOCKET client) const
+    {
+        return std::hash<SOCKET>{}(client) % workers.size();
+    }
+
+    // Hand each worker its partition of the room, sending the message to everyone but the sender
+    void dispatch(const std::vector<std::shared_ptr<const Partition>>& partitions,
+        const std::shared_ptr<const std::string>& message, SOCKET sender)
+    {
+        for (size_t i = 0; i < partitions.size() && i < workers.size(); i++)
+        {
+            if (partitions[i]->empty())
+            {
+                continue;
+            }
+            workers[i]->jobs.push({ partitions[i], message, sender });
+
+            std::atomic_thread_fence(std::memory_order_seq_cst); // Pairs with the fence in worker_loop
+            if (workers[i]->sleeping.load(std::memory_order_relaxed))
+            {
+                wake(*workers[i]);
+            }
+        }
+    }
+
+private:
+    struct Job
+    {
+        std::shared_ptr<const Partition> recipients;
+        std::shared_ptr<const std::string> message;
+        SOCKET sender = INVALID_SOCKET;
+    };
+
+    struct Worker
+    {
+        MpscQueue<Job> jobs;
+        std::atomic<bool> sleeping{ false };
+        std::atomic<uint32_t> signal{ 0 };
+        std::thread thread;
+    };
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::atomic<bool> running{ true };
+
+    static void wake(Worker& worker)
+    {
+        worker.signal.fetch_add(1, std::memory_order_release);
+        worker.signal.notify_one();
+    }
+
+    void worker_loop(Worker& worker)
+    {
+        Job job;
+        while (running)
+        {
+            if (worker.jobs.pop(job))
+            {
+                for (const std::shared_ptr<Connection>& recipient : *job.recipients)
+                {
+                    if (recipient->ClientSocket != job.sender)
+                    {
+                        recipient->send_shared(job.message);
+                    }
+                }
+                job = Job(); // Don't keep the partition alive while parked
+                continue;
+            }
+
+            // Announce we are going to sleep, then look once more so a push can't slip past
+            uint32_t seen = worker.signal.load(std::memory_order_acquire);
+            worker.sleeping.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (worker.jobs.empty() && running)
+            {
+                worker.signal.wait(seen, std::memory_order_acquire);
+            }
+            worker.sleeping.store(false, std::memory_order_relaxed);
+        }
+    }
+};
@@ -0,0 +1,179 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <functional>
+
+#include "Connection.cpp"
+
+// Counters for the batched writes
+struct FlushStats
+{
+    std::atomic<uint64_t> ticks{ 0 };       // Batches handled by a flush thread
+    std::atomic<uint64_t> connections{ 0 }; // Connections flushed, summed over ticks
+    std::atomic<uint64_t> messages{ 0 };    // Frames written
+    std::atomic<uint64_t> sends{ 0 };       // WSASend calls made
+    std::atomic<uint64_t> blocked{ 0 };     // Flushes cut short by a full socket buffer
+
+    std::string report() const
+    {
+        uint64_t t = ticks, c = connections, m = messages, s = sends, b = blocked;
+        char line[256];
+        snprintf(line, sizeof(line),
+            "Flush: %llu ticks, %llu connections, %llu messages in %llu sends (%.2f messages/send, %.2f messages/tick), %llu blocked",
+            (unsigned long long)t, (unsigned long long)c, (unsigned long long)m, (unsigned long long)s,
+            s ? (double)m / s : 0.0, t ? (double)m / t : 0.0, (unsigned long long)b);
+        return line;
+    }
+};
+
+// Writes out connections' outboxes in batches
+/*
+* -A connection is scheduled once when its outbox goes from empty to non-empty
+* -A flush thread woken from idle waits `window`, so everything queued for a connection
+*  meanwhile goes out in the same WSASend. While there is still work it goes straight on.
+* -Sockets are non-blocking: a client whose socket buffer is full is skipped and retried
+*  after RETRY_DELAY, so it can't hold up the other connections on its thread
+* -A connection always maps to the same flush thread, keeping its frames in order
+*/
+class Flusher : public FlushScheduler
+{
+public:
+    FlushStats stats;
+
+    Flusher(std::chrono::microseconds window, size_t thread_count = std::thread::hardware_concurrency())
+        : window(window)
+    {
+        if (thread_count == 0) thread_count = 4; // Default to 4 if unable to detect
+
+        for (size_t i = 0; i < thread_count; i++)
+        {
+            shards.push_back(std::make_unique<Shard>());
+        }
+        for (size_t i = 0; i < thread_count; i++)
+        {
+            shards[i]->thread = std::thread([this, i] { this->flush_loop(*shards[i]); });
+        }
+    }
+
+    ~Flusher()
+    {
+        for (auto& shard : shards)
+        {
+            {
+                std::lock_guard<std::mutex> lock(shard->mutex);
+                shard->stop = true;
+            }
+            shard->wake.notify_one();
+        }
+        for (auto& shard : shards)
+        {
+            shard->thread.join();
+        }
+    }
+
+    void schedule(std::shared_ptr<Connection> c) override
+    {
+        Shard& shard = *shards[std::hash<SOCKET>{}(c->ClientSocket) % shards.size()];
+        bool was_empty;
+        {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            was_empty = shard.dirty.empty();
+            shard.dirty.push_back(std::move(c));
+        }
+        if (was_empty)
+        {
+            shard.wake.notify_one();
+        }
+    }
+
+private:
+    static constexpr std::chrono::milliseconds RETRY_DELAY{ 1 }; // Before writing to a full socket again
+
+    struct Shard
+    {
+        std::mutex mutex;
+        std::condition_variable wake;
+        std::vector<std::shared_ptr<Connection>> dirty;
+        bool stop = false;
+        std::thread thread;
+    };
+
+    std::chrono::microseconds window;
+    std::vector<std::unique_ptr<Shard>> shards;
+
+    void flush_loop(Shard& shard)
+    {
+        std::vector<std::shared_ptr<Connection>> batch;   // To flush now
+        std::vector<std::shared_ptr<Connection>> more;    // Had more queued while being flushed
+        std::vector<std::shared_ptr<Connection>> blocked; // Socket buffer was full
+        while (true)
+        {
+            bool idle = false;
+            {
+                std::unique_lock<std::mutex> lock(shard.mutex);
+                auto woken = [&shard] { return shard.stop || !shard.dirty.empty(); };
+                if (shard.dirty.empty() && more.empty())
+                {
+                    if (blocked.empty())
+                    {
+                        shard.wake.wait(lock, woken);
+                        idle = true;
+                    }
+                    else
+                    {
+                        shard.wake.wait_for(lock, RETRY_DELAY, woken); // Give full sockets time to drain
+                    }
+                }
+                if (shard.stop)
+                {
+                    return;
+                }
+            }
+
+            if (idle && window.count() > 0) // Let more messages pile up for the same connections
+            {
+                std::this_thread::sleep_for(window);
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(shard.mutex);
+                batch.swap(shard.dirty);
+            }
+            batch.insert(batch.end(), more.begin(), more.end());
+            batch.insert(batch.end(), blocked.begin(), blocked.end());
+            more.clear();
+            blocked.clear();
+
+            uint64_t messages = 0;
+            uint64_t sends = 0;
+            for (std::shared_ptr<Connection>& c : batch)
+            {
+                FlushResult result = c->flush();
+                messages += result.frames;
+                sends += result.sends;
+                if (result.blocked)
+                {
+                    blocked.push_back(std::move(c));
+                }
+                else if (result.more)
+                {
+                    more.push_back(std::move(c));
+                }
+            }
+
+            stats.ticks++;
+            stats.connections += batch.size();
+            stats.messages += messages;
+            stats.sends += sends;
+            stats.blocked += blocked.size();
+            batch.clear();
+        }
+    }
+};
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <string>
+#include <memory>
+#include <unordered_map>
+#include <functional>
+#include <mutex>
+#include <chrono>
+
+#include "Connection.cpp"
+
+// Index of connected clients by name
+/*
+* -Sharded like the RoomRegistry, so a lookup only locks one shard
+* -Holds weak references, the receive thread and rooms own the connection
+* -Names are unique, claim() fails while someone else holds the name
+* -A client that drops keeps its name reserved while its session can be resumed, only that session
+*  can take it back
+*/
+class NameIndex
+{
+public:
+    static const size_t SHARD_COUNT = 64;
+
+    bool claim(const std::string& name, const std::shared_ptr<Connection>& c)
+    {
+        Shard& shard = shard_for(name);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        Holder& slot = shard.names[name];
+        if (!slot.owner.expired() || slot.reserved_until > Clock::now())
+        {
+            return false;
+        }
+        slot = { c };
+        return true;
+    }
+
+    // Give the name back to the session `token` on its new connection c
+    // `previous` is the session's old connection, which may still hold the name if the server hasn't
+    // noticed it drop yet. Fails if anyone else holds the name, or it is reserved for another session.
+    bool take_over(const std::string& name, const std::shared_ptr<Connection>& c,
+        const std::shared_ptr<Connection>& previous, const std::string& token)
+    {
+        Shard& shard = shard_for(name);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        Holder& slot = shard.names[name];
+        std::shared_ptr<Connection> owner = slot.owner.lock();
+        bool ours = owner ? owner == previous : (slot.reserved_until <= Clock::now() || slot.session == token);
+        if (!ours)
+        {
+            return false;
+        }
+        slot = { c };
+        return true;
+    }
+
+    // Only gives up the name if it still belongs to this connection
+    // With a token, the name stays reserved for that session until `reserved_until`
+    void release(const std::string& name, const Connection& c, const std::string& token = "",
+        std::chrono::steady_clock::time_point reserved_until = {})
+    {
+        Shard& shard = shard_for(name);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.names.find(name);
+        if (it == shard.names.end())
+        {
+            return;
+        }
+        std::shared_ptr<Connection> owner = it->second.owner.lock();
+        if (owner && owner.get() != &c)
+        {
+            return;
+        }
+        if (token.empty())
+        {
+            shard.names.erase(it);
+        }
+        else
+        {
+            it->second = { {}, token, reserved_until };
+        }
+    }
+
+    // The connection using a name, or null
+    std::shared_ptr<Connection> find(const std::string& name)
+    {
+        Shard& shard = shard_for(name);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.names.find(name);
+        return it == shard.names.end() ? nullptr : it->second.owner.lock();
+    }
+
+    // Drop reservations that have run out, one shard at a time
+    void sweep()
+    {
+        Clock::time_point now = Clock::now();
+        for (Shard& shard : shards)
+        {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            for (auto it = shard.names.begin(); it != shard.names.end();)
+            {
+                bool unused = it->second.owner.expired() && it->second.reserved_until <= now;
+                it = unused ? shard.names.erase(it) : std::next(it);
+            }
+        }
+    }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Holder
+    {
+        std::weak_ptr<Connection> owner;
+        std::string session;              // Session the name is reserved for once the owner is gone
+        Clock::time_point reserved_until; // Free for anyone from then on
+    };
+
+    struct Shard
+    {
+        std::mutex mutex;
+        std::unordered_map<std::string, Holder> names;
+    };
+
+    Shard shards[SHARD_COUNT];
+
+    Shard& shard_for(const std::string& name)
+    {
+        return shards[std::hash<std::string>{}(name) % SHARD_COUNT];
+    }
+};
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <chrono>
+#include <atomic>
+#include <algorithm>
+#include <cstdint>
+
+// Token bucket
+/*
+* -Holds up to `burst` tokens and gains `rate` tokens per second
+* -Refills lazily from the time since the last refill, no timers involved
+*/
+class TokenBucket
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    TokenBucket(double rate, double burst)
+        : rate(rate), burst(burst), tokens(burst), last(Clock::now())
+    {
+    }
+
+    void refill(Clock::time_point now)
+    {
+        double elapsed = std::chrono::duration<double>(now - last).count();
+        tokens = std::min(burst, tokens + elapsed * rate);
+        last = now;
+    }
+
+    bool available(double amount) const
+    {
+        return tokens >= amount;
+    }
+
+    void take(double amount)
+    {
+        tokens -= amount;
+    }
+
+private:
+    double rate;
+    double burst;
+    double tokens;
+    Clock::time_point last;
+};
+
+// Off unless the server is started with --rate-limit
+struct RateLimitConfig
+{
+    bool enabled = false;
+    double messages_per_second = 5.0;
+    double message_burst = 10.0;
+    double bytes_per_second = 4096.0;
+    double byte_burst = 16384.0;
+};
+
+// Server wide throttling counters
+struct RateLimitStats
+{
+    std::atomic<uint64_t> throttled_messages{ 0 };
+    std::atomic<uint64_t> throttled_clients{ 0 }; // Clients throttled at least once
+};
+
+// Limits for one client, checked before anything it sends is fanned out
+/*
+* -A message needs one token from the message bucket and its size from the byte bucket
+* -Only used by the client's receive thread, so it needs no lock
+*/
+class RateLimiter
+{
+public:
+    uint64_t throttled = 0; // Messages dropped for this client
+
+    RateLimiter(const RateLimitConfig& config, RateLimitStats& stats)
+        : messages(config.messages_per_second, config.message_burst),
+        bytes(config.bytes_per_second, config.byte_burst),
+        stats(stats)
+    {
+    }
+
+    bool allow(size_t size)
+    {
+        TokenBucket::Clock::time_point now = TokenBucket::Clock::now();
+
+        messages.refill(now);
+        bytes.refill(now);
+
+        // Only spend tokens when both buckets allow it, so a dropped message costs nothing
+        if (messages.available(1.0) && bytes.available((double)size))
+        {
+            messages.take(1.0);
+            bytes.take((double)size);
+            return true;
+        }
+
+        if (throttled++ == 0)
+        {
+            stats.throttled_clients++;
+        }
+        stats.throttled_messages++;
+        return false;
+    }
+
+private:
+    TokenBucket messages;
+    TokenBucket bytes;
+    RateLimitStats& stats;
+};
@@ -0,0 +1,222 @@
+#pragma once
+
+#include <string>
+#include <memory>
+#include <unordered_map>
+#include <mutex>
+#include <optional>
+#include <iostream>
+
+#include "Connection.cpp"
+#include "ChatHistory.cpp"
+#include "FanoutPool.cpp"
+
+// A named chat room
+/*
+* -Each room guards its own members, so traffic in one room never waits on another
+* -Messages are only delivered to members of the room
+* -Chat messages are recorded in the room's history so joiners can catch up
+* -Rooms with at least FANOUT_THRESHOLD members hand their fan-out to the FanoutPool, and keep doing so
+*  until they close: sending inline again could overtake messages still queued on the workers
+*/
+class Room
+{
+public:
+    static const size_t FANOUT_THRESHOLD = 256;
+
+    const std::string name;
+
+    Room(const std::string& name, const std::string& history_directory, FanoutPool* fanout = nullptr)
+        : name(name), fanout(fanout)
+    {
+        try
+        {
+            history = std::make_unique<ChatHistory>(history_directory);
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << "Room " << name << " has no history: " << e.what() << std::endl;
+        }
+    }
+
+    // Returns false if the room was closed by the registry and the caller must look it up again
+    // The joiner first receives the retained history, or only what came after `since` when resuming
+    // When some of what came after `since` is no longer retained, "!gap <first retained seq>" goes out first
+    // `joined_at` gets the sequence number the joiner is caught up to
+    bool join(const std::shared_ptr<Connection>& c, std::optional<uint64_t> since = std::nullopt,
+        uint64_t* joined_at = nullptr)
+    {
+        std::lock_guard<std::mutex> lock(members_mutex);
+        if (closed)
+        {
+            return false;
+        }
+        if (history)
+        {
+            uint64_t first = history->first_sequence();
+            if (since && *since + 1 < first)
+            {
+                c->send_message("!gap " + std::to_string(first));
+            }
+            history->replay(*c, since.value_or(0)); // Under the lock, so nothing is missed or repeated
+        }
+        if (joined_at != nullptr)
+        {
+            *joined_at = history ? history->last_sequence() : 0;
+        }
+        members[c->ClientSocket] = c;
+        update_partitions(c->ClientSocket);
+        return true;
+    }
+
+    // Returns the number of members left in the room
+    size_t leave(SOCKET client)
+    {
+        std::lock_guard<std::mutex> lock(members_mutex);
+        members.erase(client);
+        update_partitions(client);
+        return members.size();
+    }
+
+    // Record a chat message in the history and send it to everyone except the sender
+    // Recorded messages go out as "#<seq> <message>", so clients know where to resume from
+    // Returns false if the room was closed, nothing is recorded then: a reopened room numbers on from the
+    // same history, so the caller must look it up again
+    bool publish(const std::string& message, SOCKET sender)
+    {
+        std::lock_guard<std::mutex> lock(members_mutex);
+        if (closed)
+        {
+            return false;
+        }
+        if (!history)
+        {
+            send_to_members(message, sender);
+            return true;
+        }
+        std::string frame = "#" + std::to_string(history->last_sequence() + 1) + " " + message;
+        try
+        {
+            history->append(frame);
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << "Room " << name << " failed to record a message: " << e.what() << std::endl;
+            send_to_members(message, sender); // Still deliver it, just without a sequence number to resume from
+            return true;
+        }
+        send_to_members(frame, sender);
+        return true;
+    }
+
+    // Send a notice to everyone in the room except the sender, without recording it
+    // Returns false if the room was closed, like publish()
+    bool broadcast(const std::string& message, SOCKET sender)
+    {
+        std::lock_guard<std::mutex> lock(members_mutex);
+        if (closed)
+        {
+            return false;
+        }
+        send_to_members(message, sender);
+        return true;
+    }
+
+    // Sequence number of the newest recorded message
+    uint64_t last_sequence()
+    {
+        std::lock_guard<std::mutex> lock(members_mutex);
+        return history ? history->last_sequence() : 0;
+    }
+
+    size_t size()
+    {
+        std::lock_guard<std::mutex> lock(members_mutex);
+        return members.size();
+    }
+
+private:
+    friend class RoomRegistry;
+
+    std::mutex members_mutex;
+    std::unordered_map<SOCKET, std::shared_ptr<Connection>> members;
+    bool closed = false; // Set once the registry has dropped this room
+    std::unique_ptr<ChatHistory> history;
+    FanoutPool* fanout;
+    std::vector<std::shared_ptr<const Partition>> partitions; // Only once the room has been large
+
+    void send_to_members(const std::string& message, SOCKET sender)
+    {
+        auto shared = std::make_shared<const std::string>(message); // One copy for the whole room
+        if (!partitions.empty())
+        {
+            fanout->dispatch(partitions, shared, sender);
+            return;
+        }
+
+        for (auto& member : members)
+        {
+            if (member.first != sender)
+            {
+                member.second->send_shared(shared);
+            }
+        }
+    }
+
+    // Keep the per-worker partitions in step with the members, called with the members locked
+    // Partitions are shared with queued fan-out jobs, so a change copies only the affected one
+    // Once created they stay however small the room gets, so every later message queues behind the earlier ones
+    void update_partitions(SOCKET changed)
+    {
+        if (fanout == nullptr)
+        {
+            return;
+        }
+
+        if (partitions.empty())
+        {
+            if (members.size() < FANOUT_THRESHOLD)
+            {
+                return;
+            }
+            std::vector<Partition> split(fanout->size());
+            for (auto& member : members)
+            {
+                split[fanout->worker_for(member.first)].push_back(member.second);
+            }
+            for (Partition& partition : split)
+            {
+                partitions.push_back(std::make_shared<const Partition>(std::move(partition)));
+            }
+            return;
+        }
+
+        size_t index = fanout->worker_for(changed);
+        Partition partition;
+        partition.reserve(partitions[index]->size() + 1);
+        for (const std::shared_ptr<Connection>& member : *partitions[index])
+        {
+            if (member->ClientSocket != changed)
+            {
+                partition.push_back(member);
+            }
+        }
+        auto joined = members.find(changed);
+        if (joined != members.end())
+        {
+            partition.push_back(joined->second);
+        }
+        partitions[index] = std::make_shared<const Partition>(std::move(partition));
+    }
+
+    // Called by the registry with its shard locked
+    bool close_if_empty()
+    {
+        std::lock_guard<std::mutex> lock(members_mutex);
+        if (members.empty())
+        {
+            closed = true;
+        }
+        return closed;
+    }
+};
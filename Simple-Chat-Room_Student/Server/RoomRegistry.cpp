@@ -0,0 +1,141 @@
+#pragma once
+
+#include <string>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include <utility>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <cctype>
+#include <cstdio>
+#include <cstdint>
+
+#include "Room.cpp"
+
+// Registry of all open rooms
+/*
+* -Rooms are spread over a fixed number of shards, each with its own mutex
+* -Joining or leaving one room only locks the shard that room hashes to
+* -Empty rooms are dropped so thousands of short lived rooms don't pile up
+* -A new room recovers its history from disk before the shard is locked, so that only delays its own joiners
+*/
+class RoomRegistry
+{
+public:
+    static const size_t SHARD_COUNT = 64;
+
+    RoomRegistry(const std::string& history_root, FanoutPool* fanout = nullptr)
+        : history_root(history_root), fanout(fanout)
+    {
+    }
+
+    // Join a room by name, creating it if it doesn't exist yet
+    std::shared_ptr<Room> join(const std::string& name, const std::shared_ptr<Connection>& c,
+        std::optional<uint64_t> since = std::nullopt, uint64_t* joined_at = nullptr)
+    {
+        while (true)
+        {
+            std::shared_ptr<Room> room = find(name);
+            if (!room)
+            {
+                auto created = std::make_shared<Room>(name, history_directory(name), fanout);
+
+                Shard& shard = shard_for(name);
+                std::lock_guard<std::mutex> lock(shard.mutex);
+                std::shared_ptr<Room>& slot = shard.rooms[name];
+                if (!slot) // Otherwise someone else created it meanwhile, and `created` is dropped unused
+                {
+                    slot = created;
+                }
+                room = slot;
+            }
+
+            if (room->join(c, since, joined_at)) // Retry if the last member left while we were looking it up
+            {
+                return room;
+            }
+        }
+    }
+
+    // An open room, or null. Never creates one.
+    std::shared_ptr<Room> find(const std::string& name)
+    {
+        Shard& shard = shard_for(name);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.rooms.find(name);
+        return it == shard.rooms.end() ? nullptr : it->second;
+    }
+
+    void leave(const std::shared_ptr<Room>& room, SOCKET client)
+    {
+        if (room->leave(client) > 0)
+        {
+            return;
+        }
+
+        Shard& shard = shard_for(room->name);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.rooms.find(room->name);
+        if (it != shard.rooms.end() && it->second == room && room->close_if_empty())
+        {
+            shard.rooms.erase(it);
+        }
+    }
+
+    // Room names and member counts, up to a limit
+    std::vector<std::pair<std::string, size_t>> list(size_t limit)
+    {
+        std::vector<std::pair<std::string, size_t>> result;
+        for (Shard& shard : shards)
+        {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            for (auto& entry : shard.rooms)
+            {
+                if (result.size() >= limit)
+                {
+                    return result;
+                }
+                result.push_back({ entry.first, entry.second->size() });
+            }
+        }
+        return result;
+    }
+
+private:
+    struct Shard
+    {
+        std::mutex mutex;
+        std::unordered_map<std::string, std::shared_ptr<Room>> rooms;
+    };
+
+    Shard shards[SHARD_COUNT];
+    std::string history_root;
+    FanoutPool* fanout;
+
+    Shard& shard_for(const std::string& name)
+    {
+        return shards[std::hash<std::string>{}(name) % SHARD_COUNT];
+    }
+
+    // Room names come from clients, so only keep safe characters and add a hash to keep them apart
+    std::string history_directory(const std::string& name) const
+    {
+        std::string directory;
+        for (char c : name.substr(0, 32))
+        {
+            directory += (isalnum((unsigned char)c) || c == '-' || c == '_') ? c : '_';
+        }
+
+        uint64_t hash = 14695981039346656037ull; // FNV-1a, stable across runs unlike std::hash
+        for (char c : name)
+        {
+            hash = (hash ^ (unsigned char)c) * 1099511628211ull;
+        }
+
+        char suffix[17];
+        snprintf(suffix, sizeof(suffix), "%016llx", (unsigned long long)hash);
+        return history_root + "/" + directory + "-" + suffix;
+    }
+};
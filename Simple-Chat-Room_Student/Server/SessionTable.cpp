@@ -0,0 +1,162 @@
+#pragma once
+
+#include <string>
+#include <memory>
+#include <unordered_map>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <chrono>
+#include <random>
+
+#include "Connection.cpp"
+
+// Resume tokens for clients that drop and reconnect
+/*
+* -A token is issued once a client has its name and remembers the name and the room it is in
+* -After a disconnect the token stays valid for resume_window, a client resuming in time
+*  gets its name back and only the messages it missed
+* -Sharded like the NameIndex. An expired token is dropped when someone tries to resume it,
+*  the rest by sweep(), which the server runs on a timer
+*/
+class SessionTable
+{
+public:
+    static const size_t SHARD_COUNT = 64;
+
+    struct Session
+    {
+        std::string name;
+        std::string room;
+    };
+
+    std::chrono::seconds resume_window{ 120 };
+
+    // Issue a token for the connection and store it in c->session
+    void open(const std::shared_ptr<Connection>& c)
+    {
+        std::string token = new_token();
+        Shard& shard = shard_for(token);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.sessions[token] = { { c->client_name, c->room_name }, c, Clock::time_point::max() };
+        c->session = token;
+    }
+
+    // Hand an unexpired session to a new connection, which keeps the same token
+    // `previous` gets the session's old connection if that is still around
+    std::optional<Session> resume(const std::string& token, const std::shared_ptr<Connection>& c,
+        std::shared_ptr<Connection>& previous)
+    {
+        Shard& shard = shard_for(token);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.sessions.find(token);
+        if (it == shard.sessions.end())
+        {
+            return std::nullopt;
+        }
+        if (it->second.expires < Clock::now())
+        {
+            shard.sessions.erase(it);
+            return std::nullopt;
+        }
+        previous = it->second.owner.lock();
+        it->second.owner = c;
+        it->second.expires = Clock::time_point::max();
+        c->session = token;
+        return it->second.session;
+    }
+
+    // Remember the room the connection is in now
+    void update(const Connection& c)
+    {
+        Shard& shard = shard_for(c.session);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.sessions.find(c.session);
+        if (it != shard.sessions.end() && owned_by(it->second, c))
+        {
+            it->second.session.room = c.room_name;
+        }
+    }
+
+    // Start the resume window once the connection is gone, `expires` gets when it ends
+    // Returns false if the session had already been resumed on another connection
+    bool close(const Connection& c, std::chrono::steady_clock::time_point& expires)
+    {
+        Shard& shard = shard_for(c.session);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.sessions.find(c.session);
+        if (it == shard.sessions.end())
+        {
+            expires = Clock::time_point::min();
+            return true;
+        }
+        if (!owned_by(it->second, c))
+        {
+            return false;
+        }
+        it->second.expires = expires = Clock::now() + resume_window;
+        return true;
+    }
+
+    // Drop expired sessions, one shard at a time
+    void sweep()
+    {
+        Clock::time_point now = Clock::now();
+        for (Shard& shard : shards)
+        {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            for (auto it = shard.sessions.begin(); it != shard.sessions.end();)
+            {
+                it = it->second.expires < now ? shard.sessions.erase(it) : std::next(it);
+            }
+        }
+    }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Entry
+    {
+        Session session;
+        std::weak_ptr<Connection> owner;
+        Clock::time_point expires; // max() while a connection is using it
+    };
+
+    struct Shard
+    {
+        std::mutex mutex;
+        std::unordered_map<std::string, Entry> sessions;
+    };
+
+    Shard shards[SHARD_COUNT];
+
+    static bool owned_by(const Entry& entry, const Connection& c)
+    {
+        std::shared_ptr<Connection> owner = entry.owner.lock();
+        return !owner || owner.get() == &c;
+    }
+
+    Shard& shard_for(const std::string& token)
+    {
+        return shards[std::hash<std::string>{}(token) % SHARD_COUNT];
+    }
+
+    // 128 random bits as hex, so tokens are hard to guess
+    // Every bit comes from random_device (the OS generator): a seeded engine would only be as hard
+    // to guess as its 32-bit seed
+    static std::string new_token()
+    {
+        thread_local std::random_device device;
+        static const char digits[] = "0123456789abcdef";
+        std::string token;
+        for (int i = 0; i < 2; i++)
+        {
+            uint64_t bits = ((uint64_t)device() << 32) | device();
+            for (int j = 0; j < 16; j++, bits >>= 4)
+            {
+                token += digits[bits & 0xf];
+            }
+        }
+        return token;
+    }
+};
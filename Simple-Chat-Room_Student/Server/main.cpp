@@ -1,10 +1,34 @@
 #include "ChatServer.cpp"
 
-int main() {
+// Usage: ChatServer [--port 8080] [--bus 9090] [--bus-hub] [--flush-us 200] [--metrics 10] [--rate-limit 5]
+// Several servers started with the same --bus share their rooms, one of them runs with --bus-hub
+// --rate-limit caps each client's chat messages per second (bursts of twice that) and allows 1 KiB per message,
+// commands are never limited
+int main(int argc, char* argv[]) {
     try {
         WSASession session; // Initialize WinSock
         ChatServer server; // Create a MathServer
-        server.start("127.0.0.1", 8080); // Start the server on any address, port 8080
+        unsigned short port = 8080;
+        for (int i = 1; i < argc; i++) {
+            std::string option = argv[i];
+            if (option == "--port" && i + 1 < argc) port = (unsigned short)std::stoi(argv[++i]);
+            else if (option == "--bus" && i + 1 < argc) server.bus_port = (unsigned short)std::stoi(argv[++i]);
+            else if (option == "--bus-hub") server.bus_hub = true;
+            else if (option == "--flush-us" && i + 1 < argc) server.flush_window = std::chrono::microseconds(std::stoi(argv[++i]));
+            else if (option == "--metrics" && i + 1 < argc) server.metrics_interval_seconds = std::stoi(argv[++i]);
+            else if (option == "--rate-limit" && i + 1 < argc) {
+                server.rate_limits.enabled = true;
+                server.rate_limits.messages_per_second = std::stod(argv[++i]);
+                server.rate_limits.message_burst = server.rate_limits.messages_per_second * 2;
+                server.rate_limits.bytes_per_second = server.rate_limits.messages_per_second * 1024;
+                server.rate_limits.byte_burst = server.rate_limits.bytes_per_second * 4;
+            }
+            else {
+                std::cerr << "Unknown option: " << option << std::endl;
+                return 1;
+            }
+        }
+        server.start("127.0.0.1", port); // Start the server on any address, port 8080
     }
     catch (const std::exception& e) {
         std::cerr << "Error: " << e.what() << std::endl;